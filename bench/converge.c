@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * time to quality benchmark
+ *
+ * Renders every scene progressively, averaging passes of a few samples per
+ * pixel into the linear color aov, and compares the running image against
+ * a high sample count reference at checkpoints of render time. Error is
+ * reported as rmse and relmse, the squared error relative to the squared
+ * reference value. Each scene prints one json line with the error curve
+ * and the seconds it took to reach the target relmse, interpolated in log
+ * error between the checkpoints around it. References are rendered once
+ * and cached as pfm files keyed by the scene and model contents, size,
+ * samples and the integrator version.
+ */
+
+#define CONVERGE_EPSILON 1e-2 /* keeps relmse finite for black reference pixels */
+#define CONVERGE_REF_PASS 16 /* samples per pixel of every reference pass */
+#define CONVERGE_VERSION 2 /* bump on integrator changes so cached references are rendered again */
+
+typedef struct ConvergeConfig {
+    uint32_t width;
+    uint32_t height;
+    uint32_t spp;
+    uint32_t refSpp;
+    uint32_t threads;
+    double interval;
+    double limit;
+    double target;
+    unsigned seed;
+    const char* cache;
+} ConvergeConfig;
+
+typedef struct ConvergePoint {
+    double time;
+    uint32_t spp;
+    double rmse;
+    double relmse;
+} ConvergePoint;
+
+/* fnv-1a of a file continued from hash */
+static uint64_t converge_hash_file(const char* path, uint64_t hash)
+{
+    size_t size = 0;
+    const uint8_t* data = file_map(path, &size);
+    for (size_t i = 0; data && i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+
+    if (data) {
+        file_unmap((void*)(size_t)data, size);
+    }
+    return hash;
+}
+
+/* hashes the scene file and every model it loads, so edited scenes get a new reference */
+static uint64_t converge_hash(const char* path)
+{
+    uint64_t hash = converge_hash_file(path, 14695981039346656037ull);
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return hash;
+    }
+
+    char line[BUFSIZ], cmd[16], model[4096];
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%15s %4095s", cmd, model) == 2 && (!strcmp(cmd, "load") || !strcmp(cmd, "model"))) {
+            hash = converge_hash_file(model, hash);
+        }
+    }
+
+    fclose(file);
+    return hash;
+}
+
+static float* converge_read_pfm(const char* path, const uint32_t width, const uint32_t height)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    char type[3];
+    unsigned w, h;
+    float scale;
+    const size_t count = (size_t)width * height * 3;
+    float* data = NULL;
+
+    /* only little endian maps are written, the ones this host can read in place */
+    if (fscanf(file, "%2s %u %u %f", type, &w, &h, &scale) == 4 && !strcmp(type, "PF") &&
+        w == width && h == height && scale < 0.0f && fgetc(file) == '\n') {
+        data = malloc(sizeof(float) * count);
+        if (fread(data, sizeof(float), count, file) != count) {
+            free(data);
+            data = NULL;
+        }
+    }
+
+    fclose(file);
+    return data;
+}
+
+/* blends one more pass of spp samples into the running average of the color aov */
+static uint32_t converge_pass(Render3D* render, const Scene3D* scene, const uint32_t pass)
+{
+    render->timer = pass;
+    render3D_render(render, scene);
+    return render->spp;
+}
+
+static void converge_error(const float* image, const float* reference, const size_t count, double* rmse, double* relmse)
+{
+    double se = 0.0, rel = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        const double d = (double)image[i] - reference[i];
+        se += d * d;
+        rel += d * d / ((double)reference[i] * reference[i] + CONVERGE_EPSILON);
+    }
+
+    *rmse = sqrt(se / count);
+    *relmse = rel / count;
+}
+
+static void converge_print(FILE* file, const char* path, const ConvergeConfig* config, const double seconds, const ConvergePoint* curve, const size_t points)
+{
+    char target[32] = "null";
+    if (seconds >= 0.0) {
+        snprintf(target, sizeof(target), "%.4f", seconds);
+    }
+
+    fprintf(file, "{\"scene\":\"%s\",\"width\":%u,\"height\":%u,\"reference_spp\":%u,\"target_relmse\":%g,\"seconds_to_target\":%s,\"curve\":[",
+        path, config->width, config->height, config->refSpp, config->target, target);
+    for (size_t i = 0; i < points; ++i) {
+        fprintf(file, "%s{\"time\":%.4f,\"spp\":%u,\"rmse\":%.6g,\"relmse\":%.6g}", i ? "," : "",
+            curve[i].time, curve[i].spp, curve[i].rmse, curve[i].relmse);
+    }
+    fprintf(file, "]}\n");
+    fflush(file);
+}
+
+static float* converge_reference(const char* path, const Scene3D* scene, const ConvergeConfig* config)
+{
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    char cachePath[BUFSIZ];
+    snprintf(cachePath, sizeof(cachePath), "%s/%s.v%u.%016llx.%ux%u.%u.pfm", config->cache, base, CONVERGE_VERSION,
+        (unsigned long long)converge_hash(path), config->width, config->height, config->refSpp);
+
+    float* reference = converge_read_pfm(cachePath, config->width, config->height);
+    if (reference) {
+        fprintf(stderr, "reference\t%s\tcached\n", cachePath);
+        return reference;
+    }
+
+    Render3D render = render3D_new(config->width, config->height, CONVERGE_REF_PASS);
+    render.threads = config->threads;
+    render3D_set(&render);
+    render3D_set_aovs(&render, TRACY_AOV_BIT(TRACY_AOV_COLOR));
+
+    const double start = time_clock();
+    const uint32_t passes = (config->refSpp + CONVERGE_REF_PASS - 1) / CONVERGE_REF_PASS;
+    rand3D_base(config->seed + 1);
+    for (uint32_t i = 0; i < passes; ++i) {
+        converge_pass(&render, scene, i);
+        fprintf(stderr, "\rreference\t%s\t%u / %u spp\t%.01fs", base, (i + 1) * CONVERGE_REF_PASS, passes * CONVERGE_REF_PASS, time_clock() - start);
+    }
+    fprintf(stderr, "\n");
+
+    const size_t size = sizeof(float) * config->width * config->height * 3;
+    reference = malloc(size);
+    memcpy(reference, render.aov[TRACY_AOV_COLOR], size);
+    render3D_free(&render);
+
+    mkdir(config->cache, 0755);
+    if (image_write_pfm(cachePath, reference, config->width, config->height, 3)) {
+        tracy_error("Could not cache reference '%s', it will be rendered again.\n", cachePath);
+    }
+    return reference;
+}
+
+static int converge_scene(const char* path, const ConvergeConfig* config, FILE* output)
+{
+    Scene3D* scene = scene3D_load(path, (float)config->width / (float)config->height);
+    if (!scene) {
+        return EXIT_FAILURE;
+    }
+
+    float* reference = converge_reference(path, scene, config);
+    Render3D render = render3D_new(config->width, config->height, config->spp);
+    render.threads = config->threads;
+    render3D_set(&render);
+    render3D_set_aovs(&render, TRACY_AOV_BIT(TRACY_AOV_COLOR));
+
+    const size_t count = (size_t)config->width * config->height * 3;
+    size_t points = 0, capacity = 16;
+    ConvergePoint* curve = malloc(sizeof(ConvergePoint) * capacity);
+    double elapsed = 0.0, next = config->interval, seconds = -1.0;
+    uint32_t spp = 0;
+
+    /* only render time counts, error is computed between passes */
+    rand3D_base(config->seed);
+    for (uint32_t pass = 0; seconds < 0.0 && elapsed < config->limit; ++pass) {
+        const double start = time_clock();
+        spp += converge_pass(&render, scene, pass);
+        elapsed += time_clock() - start;
+
+        if (elapsed < next && elapsed < config->limit) {
+            continue;
+        }
+
+        while (next <= elapsed) {
+            next += config->interval;
+        }
+
+        if (points == capacity) {
+            curve = realloc(curve, sizeof(ConvergePoint) * (capacity *= 2));
+        }
+
+        ConvergePoint* p = curve + points++;
+        p->time = elapsed;
+        p->spp = spp;
+        converge_error(render.aov[TRACY_AOV_COLOR], reference, count, &p->rmse, &p->relmse);
+
+        if (p->relmse <= config->target) {
+            const ConvergePoint* q = points > 1 ? p - 1 : NULL;
+            if (q && q->relmse > p->relmse && p->relmse > 0.0) {
+                const double f = log(q->relmse / config->target) / log(q->relmse / p->relmse);
+                seconds = q->time + (p->time - q->time) * f;
+            }
+            else seconds = p->time;
+        }
+    }
+
+    converge_print(stdout, path, config, seconds, curve, points);
+    if (output) {
+        converge_print(output, path, config, seconds, curve, points);
+    }
+
+    free(curve);
+    free(reference);
+    render3D_free(&render);
+    scene3D_free(scene);
+    return EXIT_SUCCESS;
+}
+
+int main(const int argc, const char** argv)
+{
+    ConvergeConfig config = {160, 120, 1, 4096, 1, 0.5, 30.0, 0.01, 1, "bench/reference"};
+    const char* outputPath = NULL;
+    struct vector paths = vector_create(sizeof(char*));
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            config.width = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            config.height = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-spp") && i + 1 < argc) {
+            config.spp = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-ref-spp") && i + 1 < argc) {
+            config.refSpp = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            config.threads = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-interval") && i + 1 < argc) {
+            config.interval = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-limit") && i + 1 < argc) {
+            config.limit = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-target") && i + 1 < argc) {
+            config.target = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+            config.seed = (unsigned)atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-cache") && i + 1 < argc) {
+            config.cache = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        }
+        else if (argv[i][0] == '-') {
+            return tracy_error("usage: %s [-w -h -spp -ref-spp -j -seed <n>] [-interval -limit -target <f>] [-cache dir] [-o file] scene.scx ...\n", argv[0]);
+        }
+        else vector_push(&paths, &argv[i]);
+    }
+
+    if (!config.width || !config.height || !config.spp || !config.refSpp || !config.threads) {
+        return tracy_error("Benchmark size, samples and threads must be larger than 0.\n");
+    }
+
+    if (config.interval <= 0.0 || config.limit <= 0.0 || config.target <= 0.0) {
+        return tracy_error("Checkpoint interval, time limit and target error must be larger than 0.\n");
+    }
+
+    if (!paths.size) {
+        return tracy_error("Missing input scene files.\n");
+    }
+
+    FILE* output = outputPath ? fopen(outputPath, "w") : NULL;
+    if (outputPath && !output) {
+        tracy_error("Could not write file '%s'.\n", outputPath);
+    }
+
+    int status = EXIT_SUCCESS;
+    const char** p = paths.data;
+    for (size_t i = 0; i < paths.size; ++i) {
+        if (converge_scene(p[i], &config, output)) {
+            tracy_error("Convergence benchmark of scene '%s' failed.\n", p[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    if (output) {
+        fclose(output);
+    }
+    vector_free(&paths);
+    return status;
+}
@@ -0,0 +1,312 @@
+#include <tracy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * intersection kernel microbenchmark
+ *
+ * Builds a scene in memory (a bumpy grid mesh, a cloud of spheres and a few
+ * loose triangles) and drives the primitive tests, octree traversal and
+ * full scene queries directly with three synthetic ray sets: coherent
+ * camera rays, incoherent diffuse bounces off the first hits and shadow
+ * rays from those hits towards a light. Every kernel runs over the whole
+ * ray set after warmup passes; the reported time per ray is the median of
+ * the repetitions with the 10th and 90th percentiles next to it.
+ */
+
+typedef struct BenchRays {
+    const char* name;
+    Ray3D* rays;
+    size_t count;
+} BenchRays;
+
+typedef struct BenchData {
+    const Scene3D* scene;
+    const Oct3D* octree;
+    const OctPack3D* pack;
+    const Tri3D* triangles;
+    size_t triangle_count;
+    const Sphere* spheres;
+    size_t sphere_count;
+    const Box3D* boxes;
+    size_t box_count;
+} BenchData;
+
+typedef size_t (*BenchKernel)(const BenchData* data, const Ray3D* rays, const size_t count);
+
+static volatile float bench_sink;
+
+static size_t bench_tri(const BenchData* data, const Ray3D* rays, const size_t count)
+{
+    size_t hits = 0;
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        Hit3D hit;
+        if (tri3D_hit_fast(data->triangles + i % data->triangle_count, rays + i, &hit, TRACY_MAX_DIST)) {
+            sum += hit.t;
+            ++hits;
+        }
+    }
+    bench_sink = sum;
+    return hits;
+}
+
+static size_t bench_sphere(const BenchData* data, const Ray3D* rays, const size_t count)
+{
+    size_t hits = 0;
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        Hit3D hit;
+        if (sphere_hit(data->spheres[i % data->sphere_count], rays + i, &hit)) {
+            sum += hit.t;
+            ++hits;
+        }
+    }
+    bench_sink = sum;
+    return hits;
+}
+
+static size_t bench_box(const BenchData* data, const Ray3D* rays, const size_t count)
+{
+    size_t hits = 0;
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        float t;
+        if (box3D_hit_fast(data->boxes + i % data->box_count, rays + i, &t)) {
+            sum += t;
+            ++hits;
+        }
+    }
+    bench_sink = sum;
+    return hits;
+}
+
+static size_t bench_oct(const BenchData* data, const Ray3D* rays, const size_t count)
+{
+    size_t hits = 0;
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        Hit3D hit;
+        if (oct3D_hit(data->octree, rays + i, &hit, TRACY_MAX_DIST)) {
+            sum += hit.t;
+            ++hits;
+        }
+    }
+    bench_sink = sum;
+    return hits;
+}
+
+static size_t bench_pack(const BenchData* data, const Ray3D* rays, const size_t count)
+{
+    size_t hits = 0;
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        Hit3D hit;
+        if (oct3D_pack_hit(data->pack, rays + i, &hit, TRACY_MAX_DIST)) {
+            sum += hit.t;
+            ++hits;
+        }
+    }
+    bench_sink = sum;
+    return hits;
+}
+
+static size_t bench_scene(const BenchData* data, const Ray3D* rays, const size_t count)
+{
+    size_t hits = 0, id;
+    float sum = 0.0f;
+    for (size_t i = 0; i < count; ++i) {
+        Hit3D hit;
+        if (scene3D_hit(data->scene, rays + i, &hit, &id)) {
+            sum += hit.t;
+            ++hits;
+        }
+    }
+    bench_sink = sum;
+    return hits;
+}
+
+/* node boxes of the upper octree levels, the ones every ray tests */
+static void bench_boxes(const Oct3D* oct, const uint32_t depth, struct vector* boxes)
+{
+    vector_push(boxes, &oct->box);
+    if (oct->children && depth) {
+        for (int i = 0; i < 8; ++i) {
+            bench_boxes(oct->children + i, depth - 1, boxes);
+        }
+    }
+}
+
+static Scene3D* bench_build(const uint32_t grid, const uint32_t sphere_count)
+{
+    Scene3D* scene = scene3D_new();
+    const Material material = {Lambert, {0.8f, 0.8f, 0.8f}, {0.0f, 0.0f, 0.0f}, 0.5f, 1.0f};
+    const size_t zero = 0;
+    vector_push(&scene->materials, &material);
+
+    struct vector mesh = vector_create(sizeof(Tri3D));
+    for (uint32_t z = 0; z < grid; ++z) {
+        for (uint32_t x = 0; x < grid; ++x) {
+            vec3 p[4];
+            for (int i = 0; i < 4; ++i) {
+                const float u = (float)(x + (i & 1)) / grid * 20.0f - 10.0f, v = (float)(z + (i >> 1)) / grid * 20.0f - 10.0f;
+                p[i] = vec3_new(u, sinf(u * 1.3f) * cosf(v * 0.7f), v);
+            }
+            const Tri3D a = {p[0], p[2], p[1]}, b = {p[1], p[2], p[3]};
+            vector_push(&mesh, &a);
+            vector_push(&mesh, &b);
+        }
+    }
+    Model3D* model = model3D_create(mesh);
+    vector_push(&scene->models, &model);
+
+    for (uint32_t i = 0; i < sphere_count; ++i) {
+        const Sphere sphere = {{frand_signed() * 10.0f, 1.0f + frand_norm() * 4.0f, frand_signed() * 10.0f}, 0.1f + frand_norm() * 0.4f};
+        vector_push(&scene->spheres, &sphere);
+        vector_push(&scene->sphere_materials, &zero);
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        const vec3 p = {frand_signed() * 10.0f, 2.0f + frand_norm() * 3.0f, frand_signed() * 10.0f};
+        const Tri3D tri = {p, vec3_add(p, vec3_new(1.0f, 0.0f, 0.0f)), vec3_add(p, vec3_new(0.0f, 1.0f, 0.5f))};
+        vector_push(&scene->triangles, &tri);
+        vector_push(&scene->triangle_materials, &zero);
+    }
+
+    scene->cam = cam3D_new(vec3_new(0.0f, 8.0f, -16.0f), vec3_new(0.0f, 0.0f, 0.0f), vec3_new(0.0f, 1.0f, 0.0f), 60.0f, 1.0f, 0.0f, 16.0f);
+    return scene;
+}
+
+/* camera rays on a square grid, then bounces and shadow rays from their hits */
+static void bench_rays(const Scene3D* scene, const size_t count, BenchRays* sets)
+{
+    const size_t side = (size_t)sqrt((double)count);
+    const vec3 light = vec3_new(4.0f, 20.0f, -4.0f);
+    for (int i = 0; i < 3; ++i) {
+        sets[i].rays = malloc(sizeof(Ray3D) * count);
+        sets[i].count = count;
+    }
+    sets[0].name = "coherent";
+    sets[1].name = "diffuse";
+    sets[2].name = "shadow";
+
+    for (size_t i = 0; i < count; ++i) {
+        const float s = ((float)(i % side) + 0.5f) / side, t = ((float)(i / side % side) + 0.5f) / side;
+        const Ray3D ray = cam3D_ray(&scene->cam, s, t);
+        sets[0].rays[i] = ray;
+
+        Hit3D hit;
+        size_t id;
+        vec3 pos, normal;
+        if (scene3D_hit(scene, &ray, &hit, &id)) {
+            pos = _ray3D_at(&ray, hit.t);
+            normal = _vec3_dot(hit.normal, ray.dir) < 0.0f ? hit.normal : _vec3_neg(hit.normal);
+        }
+        else {
+            pos = vec3_new(frand_signed() * 10.0f, frand_norm() * 4.0f, frand_signed() * 10.0f);
+            normal = vec3_new(0.0f, 1.0f, 0.0f);
+        }
+
+        sets[1].rays[i] = ray3D_new(pos, vec3_normal(vec3_add(normal, vec3_rand())));
+        const vec3 target = vec3_add(light, vec3_mult(vec3_rand(), 2.0f));
+        sets[2].rays[i] = ray3D_new(pos, vec3_normal(vec3_sub(target, pos)));
+    }
+}
+
+static int bench_cmpd(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_run(const char* name, BenchKernel kernel, const BenchData* data, const BenchRays* set, const uint32_t warmup, const uint32_t reps)
+{
+    double times[reps];
+    size_t hits = 0;
+    for (uint32_t i = 0; i < warmup; ++i) {
+        kernel(data, set->rays, set->count);
+    }
+
+    for (uint32_t i = 0; i < reps; ++i) {
+        const double t = time_clock();
+        hits = kernel(data, set->rays, set->count);
+        times[i] = (time_clock() - t) * 1.0e9 / set->count;
+    }
+
+    qsort(times, reps, sizeof(double), &bench_cmpd);
+    const double median = times[reps / 2];
+    printf("%s\t%s\t%zu\t%.2f\t%.2f\t%.2f\t%.2f\t%zu\n", name, set->name, set->count,
+        median, times[reps / 10], times[reps - 1 - reps / 10], 1.0e3 / median, hits);
+}
+
+int main(const int argc, const char** argv)
+{
+    size_t count = 1 << 12;
+    uint32_t warmup = 2, reps = 15, grid = 64, spheres = 64;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-rays") && i + 1 < argc) {
+            count = (size_t)atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-warmup") && i + 1 < argc) {
+            warmup = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-reps") && i + 1 < argc) {
+            reps = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-grid") && i + 1 < argc) {
+            grid = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-spheres") && i + 1 < argc) {
+            spheres = (uint32_t)atoi(argv[++i]);
+        }
+        else return tracy_error("usage: %s [-rays n] [-warmup n] [-reps n] [-grid n] [-spheres n]\n", argv[0]);
+    }
+
+    if (count < 1 || !reps || !grid || !spheres) {
+        return tracy_error("Ray count, repetitions, grid size and sphere count must be larger than 0.\n");
+    }
+
+    srand(1);
+    Scene3D* scene = bench_build(grid, spheres);
+    Model3D** models = scene->models.data;
+    struct vector boxes = vector_create(sizeof(Box3D));
+    bench_boxes(&models[0]->octree, 2, &boxes);
+    OctPack3D pack = oct3D_pack(&models[0]->octree);
+
+    const BenchData data = {
+        scene, &models[0]->octree, &pack,
+        models[0]->triangles.data, models[0]->triangles.size,
+        scene->spheres.data, scene->spheres.size,
+        boxes.data, boxes.size
+    };
+
+    BenchRays sets[3];
+    bench_rays(scene, count, sets);
+
+    static const char* names[] = {"tri3D_hit_fast", "sphere_hit", "box3D_hit_fast", "oct3D_hit", "oct3D_pack_hit", "scene3D_hit"};
+    const BenchKernel kernels[] = {&bench_tri, &bench_sphere, &bench_box, &bench_oct, &bench_pack, &bench_scene};
+
+    OctReport3D report;
+    memset(&report, 0, sizeof(OctReport3D));
+    oct3D_report(&models[0]->octree, &report);
+    oct3D_pack_report(&pack, &report);
+    printf("mesh triangles: %zu, spheres: %zu, octree boxes: %zu\n", data.triangle_count, data.sphere_count, data.box_count);
+    printf("octree: %.01f KiB, packed: %.01f KiB in %llu nodes\n", report.octree_bytes / 1024.0, report.pack_bytes / 1024.0,
+        (unsigned long long)report.pack_nodes);
+    printf("kernel\t\trays\tcount\tns/ray\tp10\tp90\tMrays/s\thits\n");
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        for (int i = 0; i < 3; ++i) {
+            bench_run(names[k], kernels[k], &data, sets + i, warmup, reps);
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        free(sets[i].rays);
+    }
+    oct3D_pack_free(&pack);
+    vector_free(&boxes);
+    scene3D_free(scene);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#include <tracy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* scene load benchmark: text (.scx) vs binary (.scb) */
+
+static const char* bench_binary_path = "bench_load.scb";
+static const char* bench_text_path = "bench_load.scx";
+
+static int bench_generate(const char* path, const size_t spheres, const size_t triangles)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return tracy_error("Could not write file '%s'.\n", path);
+    }
+
+    fprintf(file, "# generated tracy stress scene\n\n");
+    fprintf(file, "material lambert {{0.8, 0.4, 0.4}, {0.0, 0.0, 0.0}, 0.5, 0.5}\n");
+    fprintf(file, "material lambert {{0.8, 0.6, 0.4}, {8.8, 6.6, 4.4}, 0.0, 0.0}\n\n");
+    fprintf(file, "lookfrom 0.0 10.0 -40.0\nlookat 0.0 0.0 0.0\nup 0.0 1.0 0.0\n\n");
+
+    srand(1);
+    for (size_t i = 0; i < spheres; ++i) {
+        fprintf(file, "sphere %d {%f, %f, %f, %f}\n", !(i % 64), frand_signed() * 20.0, frand_signed() * 20.0, frand_signed() * 20.0, 0.05 + frand_norm() * 0.2);
+    }
+    
+    for (size_t i = 0; i < triangles; ++i) {
+        const vec3 p = {frand_signed() * 20.0, frand_signed() * 20.0, frand_signed() * 20.0};
+        fprintf(
+            file, 
+            "triangle 0 {{%f, %f, %f}, {%f, %f, %f}, {%f, %f, %f}}\n", 
+            p.x, p.y, p.z, 
+            p.x + frand_norm() * 0.3, p.y, p.z, 
+            p.x, p.y + frand_norm() * 0.3, p.z + frand_signed() * 0.3
+        );
+    }
+
+    fclose(file);
+    return EXIT_SUCCESS;
+}
+
+static int cmpd(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double bench_load(const char* path, const size_t reps, size_t* count)
+{
+    double times[reps];
+    for (size_t i = 0; i < reps; ++i) {
+        const double t = time_clock();
+        Scene3D* scene = scene3D_load(path, 1.0);
+        times[i] = time_clock() - t;
+        if (!scene) {
+            return -1.0;
+        }
+        *count = scene->spheres.size + scene->triangles.size;
+        scene3D_free(scene);
+    }
+
+    qsort(times, reps, sizeof(double), &cmpd);
+    return times[reps / 2];
+}
+
+static int bench_scene(const char* path, const size_t reps)
+{
+    size_t count = 0;
+    Scene3D* scene = scene3D_load(path, 1.0);
+    if (!scene) {
+        return EXIT_FAILURE;
+    }
+    
+    const int ret = scene3D_write_binary(bench_binary_path, scene);
+    scene3D_free(scene);
+    if (ret) {
+        return ret;
+    }
+    
+    const double text = bench_load(path, reps, &count);
+    const double binary = bench_load(bench_binary_path, reps, &count);
+    remove(bench_binary_path);
+
+    printf("%s\t%zu\t%.06f\t%.06f\t%.02fx\n", path, count, text, binary, text / binary);
+    return EXIT_SUCCESS;
+}
+
+int main(const int argc, const char** argv)
+{
+    size_t reps = 5, spheres = 0, triangles = 0;
+    struct vector paths = vector_create(sizeof(char*));
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-n")) {
+            if (++i >= argc || !(reps = (size_t)atol(argv[i]))) {
+                return tracy_error("-n option expects a number larger than 0.\n");
+            }
+        }
+        else if (!strcmp(argv[i], "-gen")) {
+            if (i + 2 >= argc) {
+                return tracy_error("-gen option expects a sphere count and a triangle count.\n");
+            }
+            spheres = (size_t)atol(argv[++i]);
+            triangles = (size_t)atol(argv[++i]);
+        }
+        else vector_push(&paths, &argv[i]);
+    }
+
+    if (spheres || triangles) {
+        if (bench_generate(bench_text_path, spheres, triangles)) {
+            return EXIT_FAILURE;
+        }
+        vector_push(&paths, &bench_text_path);
+    }
+
+    if (!paths.size) {
+        return tracy_error("usage: %s [-n reps] [-gen spheres triangles] scene.scx ...\n", argv[0]);
+    }
+
+    printf("scene\tprimitives\ttext(s)\tbinary(s)\tspeedup\n");
+    
+    const char** p = paths.data;
+    for (size_t i = 0; i < paths.size; ++i) {
+        bench_scene(p[i], reps);
+    }
+
+    if (spheres || triangles) {
+        remove(bench_text_path);
+    }
+
+    vector_free(&paths);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * render benchmark suite
+ *
+ * Renders the given scenes and a set of generated stress scenes at a fixed
+ * size and seed. Every scene runs in its own process so peak memory is per
+ * scene, and reports one json line with load time, octree build time,
+ * the fastest of a few render repetitions, Mrays/s per ray type and peak
+ * rss. With -baseline, the total Mrays/s of every scene is compared
+ * against a previous run and the suite fails when a scene got slower than
+ * the threshold allows.
+ */
+
+#define BENCH_LINE 1024
+
+typedef struct BenchConfig {
+    uint32_t width;
+    uint32_t height;
+    uint32_t spp;
+    uint32_t threads;
+    uint32_t reps;
+    unsigned seed;
+} BenchConfig;
+
+typedef struct BenchResult {
+    char scene[256];
+    double mrays;
+} BenchResult;
+
+static const char* bench_mesh_path = "bench_mesh.obj";
+static const char* bench_generated[] = {"bench_spheres.scx", "bench_triangles.scx", "bench_mesh.scx", "bench_lights.scx"};
+
+static void bench_header(FILE* file, const char* lookfrom)
+{
+    fprintf(file, "# generated tracy benchmark scene\n\n");
+    fprintf(file, "material lambert {{0.8, 0.4, 0.4}, {0.0, 0.0, 0.0}, 0.5, 0.5}\n");
+    fprintf(file, "material lambert {{0.8, 0.6, 0.4}, {8.8, 6.6, 4.4}, 0.0, 0.0}\n");
+    fprintf(file, "material metal {{0.7, 0.7, 0.8}, {0.0, 0.0, 0.0}, 0.1, 0.0}\n");
+    fprintf(file, "material dielectric {{1.0, 1.0, 1.0}, {0.0, 0.0, 0.0}, 0.0, 1.5}\n\n");
+    fprintf(file, "lookfrom %s\nlookat 0.0 0.0 0.0\nup 0.0 1.0 0.0\n\n", lookfrom);
+    fprintf(file, "sphere 0 {0.0, -1000.0, 0.0, 990.0}\n");
+}
+
+/* a bumpy n by n grid, two triangles per cell */
+static int bench_mesh(const char* path, const uint32_t n)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return tracy_error("Could not write file '%s'.\n", path);
+    }
+
+    for (uint32_t z = 0; z <= n; ++z) {
+        for (uint32_t x = 0; x <= n; ++x) {
+            const float u = (float)x / n * 20.0f - 10.0f, v = (float)z / n * 20.0f - 10.0f;
+            fprintf(file, "v %f %f %f\n", u, sinf(u * 1.3f) * cosf(v * 0.7f) + frand_norm() * 0.05f, v);
+        }
+    }
+
+    for (uint32_t z = 0; z < n; ++z) {
+        for (uint32_t x = 0; x < n; ++x) {
+            const uint32_t i = z * (n + 1) + x + 1;
+            fprintf(file, "f %u %u %u\nf %u %u %u\n", i, i + n + 1, i + 1, i + 1, i + n + 1, i + n + 2);
+        }
+    }
+
+    fclose(file);
+    return EXIT_SUCCESS;
+}
+
+static int bench_generate(const unsigned seed)
+{
+    FILE* files[4];
+    for (int i = 0; i < 4; ++i) {
+        if (!(files[i] = fopen(bench_generated[i], "w"))) {
+            return tracy_error("Could not write file '%s'.\n", bench_generated[i]);
+        }
+    }
+
+    srand(seed);
+
+    /* many spheres over all material types */
+    bench_header(files[0], "0.0 10.0 -40.0");
+    for (int i = 0; i < 512; ++i) {
+        fprintf(files[0], "sphere %d {%f, %f, %f, %f}\n", i % 64 ? i % 4 == 1 ? 0 : i % 4 : 1,
+            frand_signed() * 20.0, frand_signed() * 8.0, frand_signed() * 20.0, 0.1 + frand_norm() * 0.4);
+    }
+
+    /* loose triangles are tested one by one by every ray */
+    bench_header(files[1], "0.0 10.0 -40.0");
+    fprintf(files[1], "sphere 1 {0.0, 30.0, 0.0, 5.0}\n");
+    for (int i = 0; i < 512; ++i) {
+        const vec3 p = {frand_signed() * 15.0, frand_signed() * 8.0, frand_signed() * 15.0};
+        fprintf(files[1], "triangle %d {{%f, %f, %f}, {%f, %f, %f}, {%f, %f, %f}}\n", i % 3 ? 0 : 2,
+            p.x, p.y, p.z, p.x + 0.5 + frand_norm(), p.y, p.z, p.x, p.y + 0.5 + frand_norm(), p.z + frand_signed());
+    }
+
+    /* one big mesh through the octree */
+    bench_header(files[2], "0.0 8.0 -16.0");
+    fprintf(files[2], "sphere 1 {0.0, 30.0, 0.0, 5.0}\n");
+    fprintf(files[2], "load %s\n", bench_mesh_path);
+
+    /* many lights, every diffuse hit samples all of them */
+    bench_header(files[3], "0.0 6.0 -24.0");
+    for (int i = 0; i < 64; ++i) {
+        fprintf(files[3], "sphere 1 {%f, %f, %f, 0.2}\n", frand_signed() * 12.0, 4.0 + frand_norm() * 4.0, frand_signed() * 12.0);
+    }
+    for (int i = 0; i < 64; ++i) {
+        fprintf(files[3], "sphere %d {%f, %f, %f, %f}\n", i % 4 == 1 ? 0 : i % 4,
+            frand_signed() * 10.0, frand_norm() * 2.0, frand_signed() * 10.0, 0.3 + frand_norm() * 0.7);
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        fclose(files[i]);
+    }
+
+    return bench_mesh(bench_mesh_path, 64);
+}
+
+static void bench_cleanup(void)
+{
+    for (int i = 0; i < 4; ++i) {
+        remove(bench_generated[i]);
+    }
+    remove(bench_mesh_path);
+}
+
+/* runs in a child process and writes its json line into fd */
+static int bench_scene(const char* path, const BenchConfig* config, const int fd)
+{
+    const double loadStart = time_clock();
+    Scene3D* scene = scene3D_load(path, (float)config->width / (float)config->height);
+    const double load = time_clock() - loadStart;
+    if (!scene) {
+        return EXIT_FAILURE;
+    }
+
+    /* octree builds are also part of the load, timed again on their own */
+    Model3D** models = scene->models.data;
+    size_t triangles = scene->triangles.size;
+    const double buildStart = time_clock();
+    for (size_t i = 0; i < scene->models.size; ++i) {
+        model3D_rebuild(models[i]);
+        triangles += models[i]->triangles.size;
+    }
+    const double build = time_clock() - buildStart;
+
+    Render3D render = render3D_new(config->width, config->height, config->spp);
+    render.threads = config->threads;
+    render3D_set(&render);
+
+    double time = 0.0;
+    for (uint32_t i = 0; i < config->reps; ++i) {
+        rand3D_base(config->seed);
+        stats3D_reset();
+        const double renderStart = time_clock();
+        render3D_render(&render, scene);
+        const double t = time_clock() - renderStart;
+        time = i && time < t ? time : t;
+    }
+
+    Stats3D total;
+    stats3D_read(NULL, 0, &total);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    const double scale = 1.0e-6 / time;
+    char line[BENCH_LINE];
+    const int len = snprintf(line, sizeof(line),
+        "{\"scene\":\"%s\",\"spheres\":%zu,\"triangles\":%zu,\"load\":%.6f,\"build\":%.6f,\"render\":%.6f,"
+        "\"mrays\":{\"total\":%.4f,\"primary\":%.4f,\"secondary\":%.4f,\"shadow\":%.4f},\"peak_rss_kb\":%ld}\n",
+        path, scene->spheres.size, triangles, load, build, time,
+        (total.primary_rays + total.secondary_rays + total.shadow_rays) * scale,
+        total.primary_rays * scale, total.secondary_rays * scale, total.shadow_rays * scale, usage.ru_maxrss);
+
+    render3D_free(&render);
+    scene3D_free(scene);
+    return write(fd, line, len) == len ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int bench_run(const char* path, const BenchConfig* config, char* line)
+{
+    int fds[2];
+    if (pipe(fds)) {
+        return tracy_error("Could not create a pipe.\n");
+    }
+
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == -1) {
+        return tracy_error("Could not fork benchmark process.\n");
+    }
+    if (!pid) {
+        close(fds[0]);
+        _exit(bench_scene(path, config, fds[1]));
+    }
+
+    close(fds[1]);
+    size_t size = 0;
+    ssize_t n;
+    while (size + 1 < BENCH_LINE && (n = read(fds[0], line + size, BENCH_LINE - 1 - size)) > 0) {
+        size += n;
+    }
+    line[size] = 0;
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && !WEXITSTATUS(status) && size ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool bench_parse(const char* line, BenchResult* result)
+{
+    const char* mrays = strstr(line, "\"total\":");
+    return sscanf(line, "{\"scene\":\"%255[^\"]\"", result->scene) == 1 && mrays && sscanf(mrays, "\"total\":%lf", &result->mrays) == 1;
+}
+
+static size_t bench_baseline(const char* path, BenchResult** results)
+{
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        tracy_error("Could not open baseline '%s'.\n", path);
+        return 0;
+    }
+
+    size_t count = 0, capacity = 8;
+    char line[BENCH_LINE];
+    *results = malloc(sizeof(BenchResult) * capacity);
+    while (fgets(line, sizeof(line), file)) {
+        if (count == capacity) {
+            *results = realloc(*results, sizeof(BenchResult) * (capacity *= 2));
+        }
+        count += bench_parse(line, *results + count);
+    }
+
+    fclose(file);
+    return count;
+}
+
+int main(const int argc, const char** argv)
+{
+    BenchConfig config = {160, 120, 4, 1, 3, 1};
+    const char* baselinePath = NULL;
+    const char* outputPath = NULL;
+    double threshold = 0.05;
+    bool generate = true;
+    struct vector paths = vector_create(sizeof(char*));
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            config.width = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            config.height = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-spp") && i + 1 < argc) {
+            config.spp = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            config.threads = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            config.reps = (uint32_t)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+            config.seed = (unsigned)atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) {
+            baselinePath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-threshold") && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outputPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-no-gen")) {
+            generate = false;
+        }
+        else if (argv[i][0] == '-') {
+            return tracy_error("usage: %s [-w -h -spp -j -n -seed <n>] [-baseline file] [-threshold f] [-o file] [-no-gen] scene.scx ...\n", argv[0]);
+        }
+        else vector_push(&paths, &argv[i]);
+    }
+
+    if (!config.width || !config.height || !config.spp || !config.threads || !config.reps) {
+        return tracy_error("Benchmark size, samples, threads and repetitions must be larger than 0.\n");
+    }
+
+    if (generate) {
+        if (bench_generate(config.seed)) {
+            bench_cleanup();
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < 4; ++i) {
+            vector_push(&paths, &bench_generated[i]);
+        }
+    }
+
+    BenchResult* baseline = NULL;
+    const size_t baselineCount = baselinePath ? bench_baseline(baselinePath, &baseline) : 0;
+    FILE* output = outputPath ? fopen(outputPath, "w") : NULL;
+    if (outputPath && !output) {
+        tracy_error("Could not write file '%s'.\n", outputPath);
+    }
+
+    int status = EXIT_SUCCESS;
+    const char** p = paths.data;
+    for (size_t i = 0; i < paths.size; ++i) {
+        char line[BENCH_LINE];
+        BenchResult result;
+        if (bench_run(p[i], &config, line) || !bench_parse(line, &result)) {
+            tracy_error("Benchmark of scene '%s' failed.\n", p[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("%s", line);
+        if (output) {
+            fprintf(output, "%s", line);
+        }
+
+        for (size_t j = 0; j < baselineCount; ++j) {
+            if (strcmp(baseline[j].scene, result.scene)) {
+                continue;
+            }
+
+            const double change = result.mrays / baseline[j].mrays - 1.0;
+            const bool regressed = change < -threshold;
+            fprintf(stderr, "%s\t%.4f -> %.4f Mrays/s\t%+.1f%%%s\n", result.scene, baseline[j].mrays, result.mrays, change * 100.0, regressed ? "\tREGRESSION" : "");
+            status |= regressed;
+        }
+    }
+
+    if (output) {
+        fclose(output);
+    }
+    if (generate) {
+        bench_cleanup();
+    }
+
+    free(baseline);
+    vector_free(&paths);
+    return status;
+}
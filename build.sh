@@ -92,6 +92,14 @@ ccli() {
     objs && cmd $cc tmp/*.o $cli -o tracy_cli ${flags[*]} ${inc[*]} ${lib[*]}
 }
 
+cbench() {
+    objs && cmd mkdir -p bench/bin/
+    for b in bench/*.c
+    do
+        cmd $cc tmp/*.o $b -o bench/bin/$(basename $b .c) ${flags[*]} ${inc[*]} ${lib[*]}
+    done
+}
+
 cleanf() {
     [ -f $1 ] && cmd rm $1
 }
@@ -113,6 +121,7 @@ clean() {
 
     cleand lib
     cleand tmp
+    cleand bench/bin
     cleanf $name
     cleanf tracy_cli
     return 0
@@ -127,9 +136,12 @@ case "$1" in
         crt;;
     "all")
         crt && ccli;;
+    "bench")
+        cbench;;
     "clean")
         clean;;
     *)
         echo "Run with 'cli' or 'rt' to compile runtime or client executables"
+        echo "Use 'bench' to compile the benchmarks under bench/"
         echo "Use 'clean' to remove local builds.";;
 esac
@@ -1,13 +1,30 @@
+#define _POSIX_C_SOURCE 200809L
 #include <tracy.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
-static char* first_path = NULL;
-static bool to_mp4 = false;
-static int fps = 24;
+/* output options shared by the render modes, owned by main */
+typedef struct TracyOutput {
+    char* first_path;
+    bool to_mp4;
+    int fps;
+    uint32_t denoise;
+    uint32_t aovs;
+    double denoise_time;
+    int stats;
+    FILE* stats_file;
+    uint32_t frame;
+    uint32_t frame_count;
+    double start;
+    double since; /* time of the last stats reset */
+    bool numa;
+} TracyOutput;
 
 static char* tstrdup(const char* str)
 {
@@ -17,44 +34,243 @@ static char* tstrdup(const char* str)
     return ret;
 }
 
-static struct vector tracy_load_scenes(const struct vector* scene_files, const float aspect)
+typedef struct LoadInfo {
+    const char* filename;
+    Scene3D* scene;
+    float aspect;
+} LoadInfo;
+
+static void* tracy_load_job(void* arg)
+{
+    LoadInfo* info = arg;
+    info->scene = scene3D_load(info->filename, info->aspect);
+    return NULL;
+}
+
+/* prints the octree report of every scene, of its models when it has several and of all scenes */
+static int tracy_accel_report(const struct vector* scenes)
+{
+    Scene3D** s = scenes->data;
+    OctReport3D all;
+    memset(&all, 0, sizeof(OctReport3D));
+
+    for (size_t i = 0; i < scenes->size; ++i) {
+        char name[64];
+        OctReport3D total;
+        memset(&total, 0, sizeof(OctReport3D));
+
+        Model3D** models = s[i]->models.data;
+        for (size_t j = 0; j < s[i]->models.size && s[i]->models.size > 1; ++j) {
+            OctReport3D report;
+            memset(&report, 0, sizeof(OctReport3D));
+            model3D_report(models[j], &report);
+            sprintf(name, "scene %zu model %zu", i, j);
+            tracy_log_accel(stdout, name, &report);
+        }
+
+        scene3D_report(s[i], &total);
+        scene3D_report(s[i], &all);
+        sprintf(name, "scene %zu", i);
+        tracy_log_accel(stdout, name, &total);
+    }
+
+    if (scenes->size > 1) {
+        tracy_log_accel(stdout, "all scenes", &all);
+    }
+    return EXIT_SUCCESS;
+}
+
+static struct vector tracy_load_scenes(const struct vector* scene_files, const float aspect, const uint32_t thread_count)
 {
     struct vector scenes = vector_create(sizeof(Scene3D*));
 
     char** filenames = scene_files->data;
     const size_t count = scene_files->size;
+    LoadInfo* infos = malloc(sizeof(LoadInfo) * count);
+    pthread_t threads[thread_count];
+
+    /* scene parsing is reentrant, load up to one scene per thread at a time */
+    for (size_t i = 0; i < count; i += thread_count) {
+        const size_t n = count - i < thread_count ? count - i : thread_count;
+        for (size_t j = 0; j < n; ++j) {
+            infos[i + j] = (LoadInfo){filenames[i + j], NULL, aspect};
+            if (j + 1 < n) {
+                pthread_create(&threads[j], NULL, &tracy_load_job, &infos[i + j]);
+            }
+            else tracy_load_job(&infos[i + j]);
+        }
+        for (size_t j = 0; j + 1 < n; ++j) {
+            pthread_join(threads[j], NULL);
+        }
+    }
+
     for (size_t i = 0; i < count; ++i) {
-        Scene3D* scene = scene3D_load(filenames[i], aspect);
-        if (scene) {
-            vector_push(&scenes, &scene);
+        if (infos[i].scene) {
+            vector_push(&scenes, &infos[i].scene);
         }
     }
 
+    free(infos);
     return scenes;
 }
 
-static void tracy_to_mp4(const char* path)
+/* 
+ * streamed outputs: '-o -' writes Y4M to stdout, *.y4m and *.rgb files are
+ * written as Y4M and raw RGB streams and -to-mp4 pipes raw RGB frames into
+ * ffmpeg. Format is set to -1 when frames are written as separate images.
+ */
+
+static FILE* tracy_stream_open(TracyOutput* output, const char* output_path, const Render3D* render, int* format, bool* piped)
 {
-    char command[BUFSIZ];
-    sprintf(
-        command,
-        "pushd %s && ffmpeg -framerate 24 -pattern_type glob -i '*.png' -c:v libx264 -pix_fmt yuv420p %s.mp4 && popd", 
-        path, 
-        path
-    );
-
-    system(command);
+    const char* dot = strrchr(output_path, '.');
+    *format = -1;
+    *piped = false;
+
+    if (output->to_mp4) {
+        char command[BUFSIZ + 256], path[BUFSIZ];
+        const int len = dot ? (int)(dot - output_path) : (int)strlen(output_path);
+        *format = TRACY_STREAM_RGB;
+        *piped = true;
+
+        /* the path is single quoted for the shell, quotes in it become '\'' */
+        size_t n = 0;
+        int i = 0;
+        for (; i < len && n + 4 < sizeof(path); ++i) {
+            if (output_path[i] == '\'') {
+                memcpy(path + n, "'\\''", 4);
+                n += 4;
+            }
+            else path[n++] = output_path[i];
+        }
+        path[n] = '\0';
+
+        if (i < len) {
+            tracy_error("Output path '%s' is too long.\n", output_path);
+            return NULL;
+        }
+
+        sprintf(
+            command, 
+            "ffmpeg -y -loglevel error -f rawvideo -pix_fmt rgb24 -s %ux%u -framerate %d -i - -c:v libx264 -pix_fmt yuv420p '%s.mp4'",
+            render->width,
+            render->height,
+            output->fps,
+            path
+        );
+        
+        return popen(command, "w");
+    }
+    
+    if (!strcmp(output_path, "-")) {
+        *format = TRACY_STREAM_Y4M;
+        return stdout;
+    }
+
+    if (dot && !strcmp(dot, ".y4m")) {
+        *format = TRACY_STREAM_Y4M;
+        return fopen(output_path, "wb");
+    }
+
+    if (dot && !strcmp(dot, ".rgb")) {
+        *format = TRACY_STREAM_RGB;
+        return fopen(output_path, "wb");
+    }
+
+    return NULL;
 }
 
-void scene3D_update(Scene3D* restrict scene)
+void scene3D_update(Scene3D* restrict scene, const uint32_t threads)
 {
+    scene3D_animate(scene, threads);
     scene->cam.lookFrom.x += 0.2f;
     scene->cam.focusDist = vec3_dist(scene->cam.lookFrom, scene->cam.lookAt) - 0.3;
     cam3D_update(&scene->cam);
 }
 
-static int tracy_render_scene(Render3D* restrict render, Scene3D* restrict scene, const char* restrict output_path)
+/* requested aovs are written next to the image as <name>.<aov>.pfm */
+static int tracy_write_aovs(const TracyOutput* output, const Render3D* render, const char* path)
+{
+    const char* dot = strrchr(path, '.');
+    const int len = dot ? (int)(dot - path) : (int)strlen(path);
+    int status = EXIT_SUCCESS;
+
+    for (uint32_t i = 0; i < TRACY_AOV_COUNT; ++i) {
+        if (output->aovs & TRACY_AOV_BIT(i)) {
+            char aov_path[BUFSIZ + 32];
+            sprintf(aov_path, "%.*s.%s.pfm", len, path, render3D_aov_name(i));
+            status |= image_write_pfm(aov_path, render->aov[i], render->width, render->height, render3D_aov_channels(i));
+        }
+    }
+
+    return status;
+}
+
+static void tracy_render_frame(TracyOutput* output, Render3D* restrict render, const Scene3D* restrict scene, const char* path)
+{
+    render3D_render(render, scene);
+    if (render->heatmap) {
+        float mean;
+        const float max = render3D_heat_resolve(render, &mean);
+        fprintf(output->stats_file, "heatmap:\t%s per sample\tmean %.02f\tmax %.02f\n", render3D_heatmap_name(render->heatmap), mean, max);
+    }
+    else if (output->denoise) {
+        const double time = time_clock();
+        denoise3D(render, output->denoise);
+        render3D_resolve(render);
+        output->denoise_time += time_clock() - time;
+    }
+
+    /* aov planes are reused by the next frame, so they are written right away */
+    if (output->aovs && path) {
+        tracy_write_aovs(output, render, path);
+    }
+
+    ++output->frame;
+    if (output->stats == TRACY_STATS_JSON) {
+        const double now = time_clock();
+        tracy_log_stats(output->stats_file, output->stats, output->frame, output->frame_count, now - output->start, now - output->since);
+        stats3D_reset();
+        output->since = now;
+    }
+}
+
+static uint32_t tracy_parse_aovs(const char* list)
+{
+    if (!strcmp(list, "all")) {
+        return (1u << TRACY_AOV_COUNT) - 1;
+    }
+
+    uint32_t aovs = 0;
+    while (*list) {
+        const size_t len = strcspn(list, ",");
+        uint32_t i = 0;
+        while (i < TRACY_AOV_COUNT && (strlen(render3D_aov_name(i)) != len || strncmp(list, render3D_aov_name(i), len))) {
+            ++i;
+        }
+        if (i == TRACY_AOV_COUNT) {
+            tracy_error("Unknown aov '%.*s'. See -help for more information.\n", (int)len, list);
+            return 0;
+        }
+        aovs |= TRACY_AOV_BIT(i);
+        list += len + !!list[len];
+    }
+
+    return aovs;
+}
+
+static int tracy_render_scene(TracyOutput* output, Render3D* restrict render, Scene3D* restrict scene, Output3D* out, const char* restrict output_path, const bool stream)
 {
+    const uint32_t frames = render->frames;
+    if (stream) {
+        for (uint32_t i = 0; i < frames; ++i) {
+            render->buffer = output3D_acquire(out);
+            tracy_render_frame(output, render, scene, NULL);
+            output3D_submit(out, render->buffer, NULL);
+            scene3D_update(scene, render->threads);
+        }
+        return EXIT_SUCCESS;
+    }
+
     char image_name[BUFSIZ];
     char name[1024], fmt[8];
     strcpy(name, output_path);
@@ -73,15 +289,14 @@ static int tracy_render_scene(Render3D* restrict render, Scene3D* restrict scene
     strcpy(fmt, dot);
     *dot = '\0';
 
-    const uint32_t frames = render->frames;
     if (frames == 1) {
         
-        bmp_t bmp = render3D_bmp(render, scene);
-        bmp_write(output_path, &bmp);
-        bmp_free(&bmp);
+        render->buffer = output3D_acquire(out);
+        tracy_render_frame(output, render, scene, output_path);
+        output3D_submit(out, render->buffer, output_path);
 
-        if (!first_path) {
-            first_path = tstrdup(output_path);
+        if (!output->first_path) {
+            output->first_path = tstrdup(output_path);
         }
 
         return EXIT_SUCCESS;
@@ -95,20 +310,214 @@ static int tracy_render_scene(Render3D* restrict render, Scene3D* restrict scene
     for (uint32_t i = 0; i < frames; ++i) {
         sprintf(image_name, "%s/%s%.03u%s", name, name, i + 1, fmt);
         
-        bmp_t bmp = render3D_bmp(render, scene);
-        bmp_write(image_name, &bmp);
-        bmp_free(&bmp);
-	    scene3D_update(scene);
+        /* encoding of this frame overlaps with rendering the next one */
+        render->buffer = output3D_acquire(out);
+        tracy_render_frame(output, render, scene, image_name);
+        output3D_submit(out, render->buffer, image_name);
+        scene3D_update(scene, render->threads);
 
         /* ++render->timer; */
 
-        if (!first_path) {
-            first_path = tstrdup(image_name);
+        if (!output->first_path) {
+            output->first_path = tstrdup(image_name);
         }
     }
 
-    if (to_mp4) {
-        tracy_to_mp4(name);
+    return EXIT_SUCCESS;
+}
+
+static int tracy_render_scenes(TracyOutput* output, Render3D* restrict render, const struct vector* scenes, const char* output_path)
+{
+    int format;
+    bool piped;
+    FILE* stream = tracy_stream_open(output, output_path, render, &format, &piped);
+    if (format != -1 && !stream) {
+        return tracy_error("Could not open output stream '%s'.\n", output_path);
+    }
+    
+    if (stream) {
+        /* a closed stream reader is reported as a write error */
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    if (stream == stdout) {
+        output->stats_file = stderr;
+        stats3D_progress(output->stats == TRACY_STATS_TEXT ? stderr : NULL);
+    }
+
+    /* triple buffered output, framebuffers are owned by the output stage */
+    Output3D* out = stream ? 
+        output3D_stream(stream, format, render->width, render->height, output->fps, 3) : 
+        output3D_create(render->width, render->height, 3, render->threads > 4 ? 2 : 1);
+    
+    if (stream != stdout) {
+        tracy_log_render3D(render);
+    }
+
+    if (output->aovs && stream) {
+        tracy_error("Aovs can only be written next to image outputs, ignoring -aov.\n");
+        output->aovs = 0;
+    }
+
+    if (render->heatmap && (output->denoise || output->aovs)) {
+        tracy_error("Heatmaps replace the traced image, ignoring -denoise and -aov.\n");
+        output->denoise = 0;
+        output->aovs = 0;
+    }
+
+    if (output->denoise || output->aovs) {
+        render3D_set_aovs(render, (output->denoise ? TRACY_DENOISE_FEATURES : 0) | output->aovs);
+    }
+
+    Scene3D** s = scenes->data;
+    const size_t scene_count = scenes->size;
+    for (size_t i = 0; i < scene_count; ++i) {
+        /* replicas are not animated along with their scene */
+        render->replicas = output->numa && !scene3D_animated(s[i]) ? scene3D_replicate_nodes(s[i]) : NULL;
+        const int failed = tracy_render_scene(output, render, s[i], out, output_path, !!stream);
+        scene3D_free_replicas(render->replicas);
+        render->replicas = NULL;
+        if (failed) {
+            break;
+        }
+    }
+
+    int status = output3D_free(out);
+    render->buffer = NULL;
+    render3D_set_aovs(render, 0);
+    render3D_set_heatmap(render, 0);
+
+    if (output->denoise && stream != stdout) {
+        fprintf(stdout, "denoise:\t%.03fs\n", output->denoise_time);
+    }
+
+    if (piped) {
+        status |= !!pclose(stream);
+    }
+    else if (stream && stream != stdout) {
+        fclose(stream);
+    }
+
+    if (stream && status) {
+        tracy_error("Failed writing output stream '%s'.\n", output->to_mp4 ? "ffmpeg" : output_path);
+    }
+
+    return status;
+}
+
+/*
+ * per frame image names for modes that write frames out of order. Multiple
+ * scenes get their scene number appended, animations get a directory.
+ */
+
+static char** tracy_frame_paths(TracyOutput* output, const Render3D* render, const size_t scene_count, const char* output_path)
+{
+    const char* dot = strrchr(output_path, '.');
+    if (!dot || output->to_mp4 || !strcmp(dot, ".y4m") || !strcmp(dot, ".rgb")) {
+        tracy_error("Batch and distributed modes require an image output name like .png, .jpg or .ppm.\n");
+        return NULL;
+    }
+
+    const int len = (int)(dot - output_path);
+    const uint32_t frames = render->frames;
+    char** paths = malloc(sizeof(char*) * scene_count * frames);
+
+    for (size_t i = 0; i < scene_count; ++i) {
+        char name[BUFSIZ];
+        if (scene_count > 1) {
+            sprintf(name, "%.*s%.03zu", len, output_path, i + 1);
+        }
+        else sprintf(name, "%.*s", len, output_path);
+
+        if (frames > 1) {
+            struct stat st;
+            if (stat(name, &st) == -1) {
+                mkdir(name, 0700);
+            }
+        }
+
+        for (uint32_t j = 0; j < frames; ++j) {
+            char path[BUFSIZ * 2 + 16];
+            if (frames > 1) {
+                sprintf(path, "%s/%s%.03u%s", name, name, j + 1, dot);
+            }
+            else sprintf(path, "%s%s", name, dot);
+            paths[i * frames + j] = tstrdup(path);
+        }
+    }
+
+    if (!output->first_path) {
+        output->first_path = tstrdup(paths[0]);
+    }
+
+    return paths;
+}
+
+static void tracy_frame_paths_free(char** paths, const size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+/* batch mode renders every frame of every scene on one shared tile pool */
+
+static int tracy_render_batch(TracyOutput* output, Render3D* restrict render, const struct vector* scenes, const char* output_path, const uint32_t inflight)
+{
+    char** paths = tracy_frame_paths(output, render, scenes->size, output_path);
+    if (!paths) {
+        return EXIT_FAILURE;
+    }
+
+    tracy_log_render3D(render);
+    const int status = render3D_batch(render, scenes->data, scenes->size, (const char* const*)paths, inflight, &scene3D_update);
+    tracy_frame_paths_free(paths, scenes->size * render->frames);
+    return status;
+}
+
+/*
+ * distributed mode: -coordinator hands tiles to tracy processes started
+ * with -worker on the same address, -workers forks local worker processes.
+ */
+
+static int tracy_render_dist(TracyOutput* output, Render3D* restrict render, const struct vector* scenes, const char* output_path, const char* address, const uint32_t passes, const uint32_t local)
+{
+    char** paths = tracy_frame_paths(output, render, scenes->size, output_path);
+    if (!paths) {
+        return EXIT_FAILURE;
+    }
+
+    char local_address[64];
+    if (!address) {
+        sprintf(local_address, "unix:/tmp/tracy-%ld.sock", (long)getpid());
+        address = local_address;
+    }
+
+    tracy_log_render3D(render);
+    const int status = dist3D_coordinate(render, scenes->data, scenes->size, address, (const char* const*)paths, passes, local, &scene3D_update);
+    tracy_frame_paths_free(paths, scenes->size * render->frames);
+    return status;
+}
+
+static int tracy_convert_scenes(const struct vector* scenes, const char* output_path)
+{
+    const char* dot = strrchr(output_path, '.');
+    const bool binary = dot && !strcmp(dot, ".scb");
+
+    Scene3D** s = scenes->data;
+    const size_t scene_count = scenes->size;
+    for (size_t i = 0; i < scene_count; ++i) {
+        char path[BUFSIZ];
+        if (scene_count > 1) {
+            const int len = dot ? (int)(dot - output_path) : (int)strlen(output_path);
+            sprintf(path, "%.*s%.03zu%s", len, output_path, i + 1, dot ? dot : "");
+        }
+        else strcpy(path, output_path);
+
+        if (binary ? scene3D_write_binary(path, s[i]) : scene3D_write(path, s[i])) {
+            return EXIT_FAILURE;
+        }
     }
 
     return EXIT_SUCCESS;
@@ -133,7 +542,22 @@ int main(int argc, char** argv)
     struct vector scene_files = vector_create(sizeof(char*));
     Render3D render = render3D_new(400, 400, 4);
     char output_path[BUFSIZ] = "image.png";
+    TracyOutput output = {NULL, false, 24, 0, 0, 0.0, 0, NULL, 0, 0, 0.0, 0.0, false};
     bool open = false;
+    bool convert = false;
+    uint32_t batch = 0;
+    uint32_t passes = 1;
+    uint32_t workers = 0;
+    const char* coordinator = NULL;
+    const char* worker = NULL;
+    const char* serve = NULL;
+    uint32_t jobs = 1;
+    uint32_t queue = 64;
+    uint32_t heatmap = 0;
+    const char* trace = NULL;
+    bool accel = false;
+    bool compact = false;
+    bool pin = false;
 
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "-help")) {
@@ -165,6 +589,9 @@ int main(int argc, char** argv)
         else if (!strcmp(argv[i], "-j")) {
             if (++i < argc) {
                 uint32_t j = (uint32_t)atoi(argv[i]);
+                if (!strcmp(argv[i], "auto")) {
+                    j = cpu3D_count() < 128 ? cpu3D_count() : 128;
+                }
                 if (!j || j > 128) {
                     return tracy_error("-j option cannot be smaller than 1 or larger than 128.\n");
                 }
@@ -172,6 +599,13 @@ int main(int argc, char** argv)
             }
             else return tracy_error("Missing input for option -j. See -help for more information.\n");
         }
+        else if (!strcmp(argv[i], "-pin")) {
+            pin = true;
+        }
+        else if (!strcmp(argv[i], "-numa")) {
+            pin = true;
+            output.numa = true;
+        }
         else if (!strcmp(argv[i], "-spp")) {
             if (++i < argc) {
                 render.spp = (uint32_t)atoi(argv[i]);
@@ -198,15 +632,129 @@ int main(int argc, char** argv)
         }
         else if (!strcmp(argv[i], "-fps")) {
             if (++i < argc) {
-                fps = atoi(argv[i]);
+                output.fps = atoi(argv[i]);
+                if (output.fps < 1) {
+                    return tracy_error("-fps option cannot be smaller than 1.\n");
+                }
             }
             else return tracy_error("Missing input for option -fps. See -help for more information.\n");
         }
         else if (!strcmp(argv[i], "-open")) {
             open = true;
         }
+        else if (!strcmp(argv[i], "-denoise")) {
+            output.denoise = 5;
+        }
+        else if (!strcmp(argv[i], "-aov")) {
+            if (++i < argc) {
+                output.aovs = tracy_parse_aovs(argv[i]);
+                if (!output.aovs) {
+                    return EXIT_FAILURE;
+                }
+            }
+            else return tracy_error("Missing input for option -aov. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-stats")) {
+            if (++i < argc) {
+                if (!strcmp(argv[i], "text")) {
+                    output.stats = TRACY_STATS_TEXT;
+                }
+                else if (!strcmp(argv[i], "json")) {
+                    output.stats = TRACY_STATS_JSON;
+                }
+                else return tracy_error("Unknown statistics format '%s'. See -help for more information.\n", argv[i]);
+            }
+            else return tracy_error("Missing input for option -stats. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-trace")) {
+            if (++i < argc) {
+                trace = argv[i];
+            }
+            else return tracy_error("Missing input for option -trace. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-heatmap")) {
+            if (++i < argc) {
+                for (heatmap = TRACY_HEAT_NODES; heatmap < TRACY_HEAT_COUNT && strcmp(argv[i], render3D_heatmap_name(heatmap)); ++heatmap);
+                if (heatmap == TRACY_HEAT_COUNT) {
+                    return tracy_error("Unknown heatmap '%s'. See -help for more information.\n", argv[i]);
+                }
+            }
+            else return tracy_error("Missing input for option -heatmap. See -help for more information.\n");
+        }
         else if (!strcmp(argv[i], "-to-mp4")) {
-            to_mp4 = true;
+            output.to_mp4 = true;
+        }
+        else if (!strcmp(argv[i], "-batch")) {
+            if (++i < argc) {
+                batch = (uint32_t)atoi(argv[i]);
+                if (!batch) {
+                    return tracy_error("-batch option cannot be smaller than 1.\n");
+                }
+            }
+            else return tracy_error("Missing input for option -batch. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-coordinator")) {
+            if (++i < argc) {
+                coordinator = argv[i];
+            }
+            else return tracy_error("Missing input for option -coordinator. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-worker")) {
+            if (++i < argc) {
+                worker = argv[i];
+            }
+            else return tracy_error("Missing input for option -worker. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-workers")) {
+            if (++i < argc) {
+                workers = (uint32_t)atoi(argv[i]);
+                if (!workers || workers > 256) {
+                    return tracy_error("-workers option cannot be smaller than 1 or larger than 256.\n");
+                }
+            }
+            else return tracy_error("Missing input for option -workers. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-passes")) {
+            if (++i < argc) {
+                passes = (uint32_t)atoi(argv[i]);
+                if (!passes) {
+                    return tracy_error("-passes option cannot be smaller than 1.\n");
+                }
+            }
+            else return tracy_error("Missing input for option -passes. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-serve")) {
+            if (++i < argc) {
+                serve = argv[i];
+            }
+            else return tracy_error("Missing input for option -serve. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-jobs")) {
+            if (++i < argc) {
+                jobs = (uint32_t)atoi(argv[i]);
+                if (!jobs || jobs > 128) {
+                    return tracy_error("-jobs option cannot be smaller than 1 or larger than 128.\n");
+                }
+            }
+            else return tracy_error("Missing input for option -jobs. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-queue")) {
+            if (++i < argc) {
+                queue = (uint32_t)atoi(argv[i]);
+                if (!queue) {
+                    return tracy_error("-queue option cannot be smaller than 1.\n");
+                }
+            }
+            else return tracy_error("Missing input for option -queue. See -help for more information.\n");
+        }
+        else if (!strcmp(argv[i], "-compact")) {
+            compact = true;
+        }
+        else if (!strcmp(argv[i], "-accel-report")) {
+            accel = true;
+        }
+        else if (!strcmp(argv[i], "-convert")) {
+            convert = true;
         }
         else vector_push(&scene_files, &argv[i]);
     }
@@ -216,43 +764,116 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    struct vector scenes = tracy_load_scenes(&scene_files, (float)render.width / (float)render.height);
+    if (trace) {
+        timeline3D_enable(TRACY_TIMELINE_SPANS);
+    }
+
+    struct vector scenes = tracy_load_scenes(&scene_files, (float)render.width / (float)render.height, render.threads);
     if (!scenes.size) {
         return tracy_error("No valid path to scene file was found.\n");
     }
 
-    render3D_set(&render);
-    tracy_log_render3D(&render);
-#ifdef TRACY_PERF
-    double time = time_clock();
-#endif
-
     Scene3D** s = scenes.data;
     const size_t scene_count = scenes.size;
-    for (size_t i = 0; i < scene_count; ++i) {
-        if (tracy_render_scene(&render, s[i], output_path)) {
-            break;
+    for (size_t i = 0; compact && i < scene_count; ++i) {
+        scene3D_compact(s[i]);
+    }
+
+    if (convert || accel) {
+        const int ret = convert ? tracy_convert_scenes(&scenes, output_path) : tracy_accel_report(&scenes);
+        for (size_t i = 0; i < scene_count; ++i) {
+            scene3D_free(s[i]);
         }
+        vector_free(&scenes);
+        vector_free(&scene_files);
+        return ret;
+    }
+
+    output.stats_file = stdout;
+    output.frame_count = (uint32_t)scene_count * render.frames;
+    output.start = output.since = time_clock();
+    stats3D_progress(output.stats == TRACY_STATS_TEXT ? stdout : NULL);
+
+    /* heat is only collected by the local tile path */
+    if (heatmap && (serve || worker || coordinator || workers || batch)) {
+        tracy_error("Heatmaps cannot be rendered in server, distributed or batch modes, ignoring -heatmap.\n");
+    }
+    else if (heatmap) {
+        render3D_set_heatmap(&render, heatmap);
+    }
+
+    /* the filter needs the aov planes of a whole frame, only the local frame path keeps them */
+    if (output.denoise && (serve || worker || coordinator || workers || batch)) {
+        tracy_error("Denoising cannot be done in server, distributed or batch modes, ignoring -denoise.\n");
+        output.denoise = 0;
+    }
+
+    if (output.aovs && (serve || worker || coordinator || workers || batch)) {
+        tracy_error("Aovs cannot be written in server, distributed or batch modes, ignoring -aov.\n");
+        output.aovs = 0;
+    }
+
+    /* forked workers and concurrent server jobs would all pin to the first cpus */
+    if (pin && (serve || worker || coordinator || workers)) {
+        tracy_error("Threads cannot be pinned in server or distributed modes, ignoring -pin and -numa.\n");
+        output.numa = false;
     }
+    else if (pin) {
+        cpu3D_pinning(true);
+        output.numa = output.numa && cpu3D_nodes() > 1;
+        /* batch workers move between frames of every scene, there is no one scene to replicate */
+        if (output.numa && batch) {
+            tracy_error("Scenes are not replicated in batch mode, -numa only pins threads.\n");
+        }
+    }
+
+    /* server jobs and batch frames are reported by the thread that finishes them */
+    const bool reported = output.stats && (serve || (batch && !worker && !coordinator && !workers && output.stats == TRACY_STATS_JSON));
+    if (reported) {
+        stats3D_report(output.stats_file, output.stats, serve ? 0 : output.frame_count);
+    }
+
+    int status;
+    if (serve) {
+        /* job scene ids must match the command line, so every scene has to load */
+        status = scene_count == scene_files.size ?
+            server3D_run(&render, s, scene_files.data, scene_count, serve, jobs, queue) :
+            tracy_error("All scenes must load to run a render server.\n");
+    }
+    else if (worker) {
+        status = dist3D_work(&render, s, scene_count, worker, &scene3D_update);
+    }
+    else if (coordinator || workers) {
+        status = tracy_render_dist(&output, &render, &scenes, output_path, coordinator, passes, workers);
+    }
+    else if (batch) {
+        status = tracy_render_batch(&output, &render, &scenes, output_path, batch);
+    }
+    else status = tracy_render_scenes(&output, &render, &scenes, output_path);
     
-#ifdef TRACY_PERF
-    tracy_log_time(time_clock() - time);
-#endif
+    /* modes without per frame reports get one for the whole job */
+    if (!reported && (output.stats == TRACY_STATS_TEXT || (output.stats && output.frame < output.frame_count))) {
+        const double now = time_clock();
+        tracy_log_stats(output.stats_file, output.stats, status ? output.frame : output.frame_count, output.frame_count, now - output.start, now - output.since);
+    }
 
     for (size_t i = 0; i < scene_count; ++i) {
         scene3D_free(s[i]);
     }
 
-    render3D_free(&render);
     vector_free(&scenes);
     vector_free(&scene_files);
 
-    if (first_path) {
+    if (trace) {
+        status |= timeline3D_export(trace);
+    }
+
+    if (output.first_path) {
         if (open) {
-            tracy_open_image(first_path);
+            tracy_open_image(output.first_path);
         }
-        free(first_path);
+        free(output.first_path);
     }
     
-    return EXIT_SUCCESS;
+    return status;
 }
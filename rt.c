@@ -6,6 +6,7 @@
 #include <spxe.h>
 
 #define HALF_PI (M_PI * 0.5F)
+#define VIEW_PREEMPT_BUDGET 0.1 /* seconds a changing view may go without a new frame */
 
 static void cam3D_point(Cam3D* cam, vec3* dir, vec3* right, const int x, const int y)
 {
@@ -21,11 +22,60 @@ static void cam3D_point(Cam3D* cam, vec3* dir, vec3* right, const int x, const i
     cam->lookAt = vec3_add(cam->lookFrom, *dir);
 }
 
+/*
+ * frames are traced by a render context in the background while the loop
+ * below keeps polling input and presenting. Workers flag finished tiles so
+ * a frame with no history to show can be presented tile by tile.
+ */
+
+typedef struct ViewFrame {
+    uint8_t* ready;
+    uint32_t tiles_x;
+    double finished;
+} ViewFrame;
+
+static void view_tile(const Tile3D* tile, void* userdata)
+{
+    ViewFrame* frame = userdata;
+    const uint32_t index = (tile->y / TRACY_TILE_SIZE) * frame->tiles_x + tile->x / TRACY_TILE_SIZE;
+    if (tile->done == tile->count) {
+        frame->finished = time_clock();
+    }
+    __atomic_store_n(frame->ready + index, 1, __ATOMIC_RELEASE);
+}
+
+/* copies the tiles finished since the last call into the presented image */
+static void view_present_tiles(ViewFrame* frame, const Render3D* render, uint8_t* pixels)
+{
+    const uint32_t size = TRACY_TILE_SIZE;
+    const uint32_t tiles = frame->tiles_x * ((render->height + size - 1) / size);
+    for (uint32_t i = 0; i < tiles; ++i) {
+        if (__atomic_load_n(frame->ready + i, __ATOMIC_ACQUIRE) != 1) {
+            continue;
+        }
+
+        const uint32_t x0 = (i % frame->tiles_x) * size, y0 = (i / frame->tiles_x) * size;
+        const uint32_t x1 = x0 + size < render->width ? x0 + size : render->width;
+        const uint32_t y1 = y0 + size < render->height ? y0 + size : render->height;
+        for (uint32_t y = y0; y < y1; ++y) {
+            const size_t offset = ((size_t)y * render->width + x0) * 4;
+            memcpy(pixels + offset, render->buffer + offset, (x1 - x0) * 4);
+        }
+        frame->ready[i] = 2;
+    }
+}
+
 int main(const int argc, const char** argv) 
 {   
+    const double startTime = time_clock();
     const char* scenePath = NULL;
     char outPath[BUFSIZ] = "image.png";
     Render3D render = render3D_new(200, 150, 1);
+    bool lazy = false;
+    bool compact = false;
+    float targetMs = 0.0f;
+    uint32_t heatmap = 0;
+    const char* trace = NULL;
     
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "-help")) {
@@ -57,6 +107,9 @@ int main(const int argc, const char** argv)
         else if (!strcmp(argv[i], "-j")) {
             if (++i < argc) {
                 uint32_t j = (uint32_t)atoi(argv[i]);
+                if (!strcmp(argv[i], "auto")) {
+                    j = cpu3D_count() < 128 ? cpu3D_count() : 128;
+                }
                 if (!j || j > 128) {
                     return tracy_error("%s option cannot be smaller than 1 or larger than 128.\n", argv[i]);
                 }
@@ -79,6 +132,39 @@ int main(const int argc, const char** argv)
             }
             else return tracy_error("Missing input for option %s. See -help for more information.\n", argv[i]);
         }
+        else if (!strcmp(argv[i], "-lazy")) {
+            lazy = true;
+        }
+        else if (!strcmp(argv[i], "-compact")) {
+            compact = true;
+        }
+        else if (!strcmp(argv[i], "-pin")) {
+            cpu3D_pinning(true);
+        }
+        else if (!strcmp(argv[i], "-target-ms")) {
+            if (++i < argc) {
+                targetMs = (float)atof(argv[i]);
+                if (targetMs <= 0.0f) {
+                    return tracy_error("%s option must be larger than 0.\n", argv[i]);
+                }
+            }
+            else return tracy_error("Missing input for option %s. See -help for more information.\n", argv[i]);
+        }
+        else if (!strcmp(argv[i], "-trace")) {
+            if (++i < argc) {
+                trace = argv[i];
+            }
+            else return tracy_error("Missing input for option %s. See -help for more information.\n", argv[i]);
+        }
+        else if (!strcmp(argv[i], "-heatmap")) {
+            if (++i < argc) {
+                for (heatmap = TRACY_HEAT_NODES; heatmap < TRACY_HEAT_COUNT && strcmp(argv[i], render3D_heatmap_name(heatmap)); ++heatmap);
+                if (heatmap == TRACY_HEAT_COUNT) {
+                    return tracy_error("Unknown heatmap '%s'. See -help for more information.\n", argv[i]);
+                }
+            }
+            else return tracy_error("Missing input for option %s. See -help for more information.\n", argv[i]);
+        }
         else scenePath = argv[i];
     }
 
@@ -87,23 +173,68 @@ int main(const int argc, const char** argv)
         return EXIT_FAILURE;
     }
     
-    Scene3D* scene = scene3D_load(scenePath, (float)render.width / (float)render.height);
+    if (trace) {
+        timeline3D_enable(TRACY_TIMELINE_SPANS);
+    }
+
+    const float aspect = (float)render.width / (float)render.height;
+    Scene3D* scene = lazy ? scene3D_load_lazy(scenePath, aspect) : scene3D_load(scenePath, aspect);
     if (!scene) {
         return EXIT_FAILURE;
     }
 
+    if (compact) {
+        scene3D_compact(scene);
+    }
+
+    const double loadTime = time_clock() - startTime;
+    bool firstFrame = true;
+
     tracy_log_render3D(&render);
 
     Px* pixbuf = spxeStart("tracy", 800, 600, render.width, render.height);
-    render.buffer = (unsigned char*)pixbuf; 
+    render3D_set(&render);
     double T = spxeTime();
 
+    /* input edits a copy of the camera and the first material, both are
+     * only written into the scene between frames */
+    Cam3D view = scene->cam;
+    Material* const mat = scene->materials.data;
+    Material edit = *mat;
+
     vec3 dir, right;
     int mousex = 0, mousey = 0, x, y;
     spxeMousePos(&mousex, &mousey);
-    cam3D_point(&scene->cam, &dir, &right, mousex, mousey);
+    cam3D_point(&view, &dir, &right, mousex, mousey);
 
-    Material* const mat = scene->materials.data;
+    /* every frame traces fresh samples and accumulates them over the
+     * reprojected history, so moving the camera keeps converged pixels */
+    const uint32_t aovs = TRACY_AOV_BIT(TRACY_AOV_COLOR) | TRACY_AOV_BIT(TRACY_AOV_DEPTH) | TRACY_AOV_BIT(TRACY_AOV_NORMAL);
+    render3D_set_aovs(&render, aovs);
+    Temporal3D temporal = temporal3D_create(render.width, render.height);
+    bool moved = true, reset = true, heatLog = false;
+
+    /* with a frame time target, moving frames are traced at a lower
+     * resolution into full sized scratch buffers and upscaled before the
+     * temporal resolve. The budget comes from a running seconds-per-sample
+     * estimate; a still camera goes back to full resolution and spends
+     * the budget on samples per pixel instead. */
+    const uint32_t spp = render.spp;
+    Render3D scaled = render3D_new(render.width, render.height, spp);
+    double sampleCost = 0.0;
+    if (targetMs > 0.0f) {
+        scaled.threads = render.threads;
+        render3D_set(&scaled);
+        render3D_set_aovs(&scaled, aovs);
+    }
+
+    const uint32_t size = TRACY_TILE_SIZE;
+    const uint32_t tiles_x = (render.width + size - 1) / size;
+    ViewFrame viewFrame = {calloc(tiles_x * ((render.height + size - 1) / size), 1), tiles_x, 0.0};
+    Context3D* ctx = context3D_create(render.threads);
+    Render3D* frame = NULL;
+    double frameStart = 0.0, presented = time_clock();
+    const double preempt = targetMs > 0.0f ? targetMs * 0.001 : VIEW_PREEMPT_BUDGET;
 
     while (spxeRun(pixbuf)) {
         double t = spxeTime();
@@ -115,165 +246,254 @@ int main(const int argc, const char** argv)
         }
         if (spxeKeyDown(W)) {
             const vec3 d = vec3_mult(dir, dT);
-            scene->cam.lookFrom = vec3_add(scene->cam.lookFrom, d);
-            scene->cam.lookAt = vec3_add(scene->cam.lookAt, d);
-            render.timer = 0;
+            view.lookFrom = vec3_add(view.lookFrom, d);
+            view.lookAt = vec3_add(view.lookAt, d);
+            moved = true;
         }
         if (spxeKeyDown(S)) {
             const vec3 d = vec3_mult(dir, dT);
-            scene->cam.lookFrom = vec3_sub(scene->cam.lookFrom, d);
-            scene->cam.lookAt = vec3_sub(scene->cam.lookAt, d);
-            render.timer = 0;
+            view.lookFrom = vec3_sub(view.lookFrom, d);
+            view.lookAt = vec3_sub(view.lookAt, d);
+            moved = true;
         }
         if (spxeKeyDown(D)) {
             const vec3 d = vec3_mult(right, dT);
-            scene->cam.lookFrom = vec3_add(scene->cam.lookFrom, d);
-            scene->cam.lookAt = vec3_add(scene->cam.lookAt, d);
-            render.timer = 0;
+            view.lookFrom = vec3_add(view.lookFrom, d);
+            view.lookAt = vec3_add(view.lookAt, d);
+            moved = true;
         }
         if (spxeKeyDown(A)) {
             const vec3 d = vec3_mult(right, dT);
-            scene->cam.lookFrom = vec3_sub(scene->cam.lookFrom, d);
-            scene->cam.lookAt = vec3_sub(scene->cam.lookAt, d);
-            render.timer = 0;
+            view.lookFrom = vec3_sub(view.lookFrom, d);
+            view.lookAt = vec3_sub(view.lookAt, d);
+            moved = true;
         }
         if (spxeKeyDown(Z)) {
-            const vec3 d = vec3_mult(scene->cam.up, dT);
-            scene->cam.lookFrom = vec3_add(scene->cam.lookFrom, d);
-            scene->cam.lookAt = vec3_add(scene->cam.lookAt, d);
-            render.timer = 0;
+            const vec3 d = vec3_mult(view.up, dT);
+            view.lookFrom = vec3_add(view.lookFrom, d);
+            view.lookAt = vec3_add(view.lookAt, d);
+            moved = true;
         }
         if (spxeKeyDown(X)) {
-            const vec3 d = vec3_mult(scene->cam.up, dT);
-            scene->cam.lookFrom = vec3_sub(scene->cam.lookFrom, d);
-            scene->cam.lookAt = vec3_sub(scene->cam.lookAt, d);
-            render.timer = 0;
+            const vec3 d = vec3_mult(view.up, dT);
+            view.lookFrom = vec3_sub(view.lookFrom, d);
+            view.lookAt = vec3_sub(view.lookAt, d);
+            moved = true;
         }
 
         if (spxeKeyDown(M)) {
-            mat->ri += 0.01;
-            printf("Ri: %f\n", mat->ri);
-            render.timer = 0;
+            edit.ri += 0.01;
+            printf("Ri: %f\n", edit.ri);
+            reset = true;
         }
         if (spxeKeyDown(N)) {
-            mat->ri -= 0.01;
-            printf("Ri: %f\n", mat->ri);
-            render.timer = 0;
+            edit.ri -= 0.01;
+            printf("Ri: %f\n", edit.ri);
+            reset = true;
         }
         if (spxeKeyDown(J)) {
-            mat->roughness += 0.01;
-            printf("Ro: %f\n", mat->roughness);
-            render.timer = 0;
+            edit.roughness += 0.01;
+            printf("Ro: %f\n", edit.roughness);
+            reset = true;
         }
         if (spxeKeyDown(K)) {
-            mat->roughness -= 0.01;
-            printf("Ro: %f\n", mat->roughness);
-            render.timer = 0;
+            edit.roughness -= 0.01;
+            printf("Ro: %f\n", edit.roughness);
+            reset = true;
         }
         if (spxeKeyDown(LEFT_SHIFT)) {
             if (spxeKeyDown(R)) {
                 if (spxeKeyDown(RIGHT) || spxeKeyDown(UP)) {
-                    mat->albedo.x += 0.01;
-                    render.timer = 0;
+                    edit.albedo.x += 0.01;
+                    reset = true;
                 }
                 if (spxeKeyDown(LEFT) || spxeKeyDown(DOWN)) {
-                    mat->albedo.x -= 0.01;
-                    render.timer = 0;
+                    edit.albedo.x -= 0.01;
+                    reset = true;
                 }
             }
             if (spxeKeyDown(G)) {
                 if (spxeKeyDown(RIGHT) || spxeKeyDown(UP)) {
-                    mat->albedo.y += 0.01;
-                    render.timer = 0;
+                    edit.albedo.y += 0.01;
+                    reset = true;
                 }
                 if (spxeKeyDown(LEFT) || spxeKeyDown(DOWN)) {
-                    mat->albedo.y -= 0.01;
-                    render.timer = 0;
+                    edit.albedo.y -= 0.01;
+                    reset = true;
                 }
             }
             if (spxeKeyDown(B)) {
                 if (spxeKeyDown(RIGHT) || spxeKeyDown(UP)) {
-                    mat->albedo.z += 0.01;
-                    render.timer = 0;
+                    edit.albedo.z += 0.01;
+                    reset = true;
                 }
                 if (spxeKeyDown(LEFT) || spxeKeyDown(DOWN)) {
-                    mat->albedo.z -= 0.01;
-                    render.timer = 0;
+                    edit.albedo.z -= 0.01;
+                    reset = true;
                 }
             }
         }
         if (spxeKeyDown(E)) {
             if (spxeKeyDown(R)) {
                 if (spxeKeyDown(RIGHT) || spxeKeyDown(UP)) {
-                    mat->emissive.x += 0.01;
-                    render.timer = 0;
+                    edit.emissive.x += 0.01;
+                    reset = true;
                 }
                 if (spxeKeyDown(LEFT) || spxeKeyDown(DOWN)) {
-                    mat->emissive.x -= 0.01;
-                    render.timer = 0;
+                    edit.emissive.x -= 0.01;
+                    reset = true;
                 }
             }
             if (spxeKeyDown(G)) {
                 if (spxeKeyDown(RIGHT) || spxeKeyDown(UP)) {
-                    mat->emissive.y += 0.01;
-                    render.timer = 0;
+                    edit.emissive.y += 0.01;
+                    reset = true;
                 }
                 if (spxeKeyDown(LEFT) || spxeKeyDown(DOWN)) {
-                    mat->emissive.y -= 0.01;
-                    render.timer = 0;
+                    edit.emissive.y -= 0.01;
+                    reset = true;
                 }
             }
             if (spxeKeyDown(B)) {
                 if (spxeKeyDown(RIGHT) || spxeKeyDown(UP)) {
-                    mat->emissive.z += 0.01;
-                    render.timer = 0;
+                    edit.emissive.z += 0.01;
+                    reset = true;
                 }
                 if (spxeKeyDown(LEFT) || spxeKeyDown(DOWN)) {
-                    mat->emissive.z -= 0.01;
-                    render.timer = 0;
+                    edit.emissive.z -= 0.01;
+                    reset = true;
                 }
             }
         }
         if (spxeKeyPressed(U)) {
-            ++mat->type;
-            if (mat->type > Dielectric) {
-                mat->type = Lambert;
+            ++edit.type;
+            if (edit.type > Dielectric) {
+                edit.type = Lambert;
             }
+            reset = true;
+        }
+
+        if (spxeKeyPressed(H)) {
+            heatmap = (heatmap + 1) % TRACY_HEAT_COUNT;
+            printf("Heatmap: %s\n", render3D_heatmap_name(heatmap));
+            reset = true;
         }
 
         if (spxeKeyPressed(P)) {
-            bmp_t bmp = {render.width, render.height, 4, render.buffer};
-            bmp = bmp_flip_vertical(&bmp);
-            bmp_write(outPath, &bmp);
-            bmp_free(&bmp);
+            image_write(outPath, (uint8_t*)pixbuf, render.width, render.height);
         }
 
         spxeMousePos(&x, &y);
         if (mousex != x || mousey != y) {
-            cam3D_point(&scene->cam, &dir, &right, x, y);
+            cam3D_point(&view, &dir, &right, x, y);
             mousex = x;
             mousey = y;
-            render.timer = 0;
+            moved = true;
         }
         
-        if (!render.timer) {
-            
+        /* a changed view preempts the frame in flight at the next tile,
+         * unless nothing was presented for longer than the budget, so
+         * constant motion or held edits still produce frames */
+        if (frame && (reset || moved) && time_clock() - presented < preempt) {
+            context3D_cancel(ctx);
+        }
+
+        if (frame && !context3D_busy(ctx)) {
+            if (context3D_wait(ctx) == EXIT_SUCCESS) {
+                if (frame != &render) {
+                    render3D_upscale(frame, &render);
+                }
+
+                if (render.heatmap) {
+                    float mean;
+                    const float max = render3D_heat_resolve(&render, &mean);
+                    memcpy(pixbuf, render.buffer, (size_t)render.width * render.height * 4);
+                    if (heatLog) {
+                        printf("Heatmap %s per sample: mean %.02f, max %.02f\n", render3D_heatmap_name(render.heatmap), mean, max);
+                        heatLog = false;
+                    }
+                }
+                else {
+                    const double cost = (viewFrame.finished - frameStart) / ((double)frame->width * frame->height * frame->spp);
+                    sampleCost = sampleCost > 0.0 ? sampleCost * 0.5 + cost * 0.5 : cost;
+                    temporal3D_resolve(&temporal, &render, &scene->cam, (uint8_t*)pixbuf);
+                }
+
+                presented = time_clock();
+                if (firstFrame) {
+                    printf("scene load: %.03fs, time to first frame: %.03fs\n", loadTime, time_clock() - startTime);
+                    firstFrame = false;
+                }
+            }
+            frame = NULL;
+        }
+        else if (frame == &render && !temporal.valid && !render.heatmap) {
+            view_present_tiles(&viewFrame, &render, (uint8_t*)pixbuf);
+        }
+
+        if (frame) {
+            continue;
+        }
+
+        if (moved || reset) {
             size_t id;
             Hit3D h;
-            Ray3D r = cam3D_ray(&scene->cam, (float)render.width * 0.5 / (float)render.width, (float)render.height * 0.5 / (float)render.height);
+            Ray3D r = cam3D_ray(&view, (float)render.width * 0.5 / (float)render.width, (float)render.height * 0.5 / (float)render.height);
             if (scene3D_hit(scene, &r, &h, &id)) {
-                scene->cam.focusDist = h.t;
+                view.focusDist = h.t;
             }
 
-            cam3D_update(&scene->cam);
+            cam3D_update(&view);
+            scene->cam = view;
+        }
+
+        if (reset) {
+            *mat = edit;
+            temporal3D_reset(&temporal);
+            if (heatmap != render.heatmap) {
+                render3D_set_heatmap(&render, heatmap);
+                heatLog = !!heatmap;
+            }
         }
 
-        render3D_render(&render, scene);
-        ++render.timer;
+        /* heat is measured at the requested resolution and sample count */
+        frame = &render;
+        if (render.heatmap) {
+            render.spp = spp;
+        }
+        else if (targetMs > 0.0f && sampleCost > 0.0) {
+            const double pixels = (double)render.width * render.height;
+            const double budget = targetMs * 0.001 / sampleCost;
+            if (moved) {
+                double scale = sqrt(budget / (pixels * spp));
+                scale = scale < 0.25 ? 0.25 : scale;
+                if (scale < 1.0) {
+                    scaled.width = (uint32_t)(render.width * scale) ? (uint32_t)(render.width * scale) : 1;
+                    scaled.height = (uint32_t)(render.height * scale) ? (uint32_t)(render.height * scale) : 1;
+                    frame = &scaled;
+                }
+                render.spp = spp;
+            }
+            else {
+                const double samples = budget / pixels;
+                render.spp = samples < 1.0 ? 1 : samples > 16.0 * spp ? 16 * spp : (uint32_t)samples;
+            }
+        }
 
-        //printf("%lf\n", dT);
+        memset(viewFrame.ready, 0, tiles_x * ((render.height + size - 1) / size));
+        frameStart = viewFrame.finished = time_clock();
+        context3D_submit(ctx, frame, scene, &view_tile, &viewFrame);
+        moved = reset = false;
     }
 
+    context3D_free(ctx);
+    free(viewFrame.ready);
+    temporal3D_free(&temporal);
+    render3D_free(&render);
+    render3D_free(&scaled);
     scene3D_free(scene);
+    if (trace) {
+        timeline3D_export(trace);
+    }
     return spxeEnd(pixbuf);
 }
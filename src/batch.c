@@ -0,0 +1,206 @@
+#include <tracy.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * batch rendering schedules the tiles of every frame of every scene on a
+ * single pool of workers. A frame is opened when a framebuffer is available
+ * and the frame is ready; frames of static scenes are ready up front with
+ * precomputed cameras, frames of animated scenes only after the previous
+ * frame of the same scene was finished and the scene was updated. The
+ * worker finishing the last tile of a frame writes its image.
+ */
+
+typedef struct BatchFrame {
+    Scene3D* scene;
+    const char* path;
+    uint8_t* buffer;
+    Cam3D cam;
+    uint32_t index;
+    uint32_t next_tile;
+    uint32_t done_tiles;
+    bool ready;
+    bool opened;
+    bool animated;
+} BatchFrame;
+
+typedef struct Batch {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const Render3D* render;
+    Update3D update;
+    BatchFrame* frames;
+    BatchFrame** open;
+    size_t frame_count;
+    size_t finished;
+    size_t cursor;
+    uint32_t open_count;
+    uint32_t inflight;
+    uint32_t max_inflight;
+    uint32_t tiles_x;
+    uint32_t tile_count;
+    uint32_t slots;
+    int status;
+} Batch;
+
+/* first ready frame that has not been opened yet, in submission order */
+static BatchFrame* batch_next(Batch* batch)
+{
+    while (batch->cursor < batch->frame_count && batch->frames[batch->cursor].opened) {
+        ++batch->cursor;
+    }
+
+    for (size_t i = batch->cursor; i < batch->frame_count; ++i) {
+        BatchFrame* f = batch->frames + i;
+        if (!f->opened && f->ready) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+static void batch_finish(Batch* batch, BatchFrame* f)
+{
+    const Render3D* render = batch->render;
+    const int status = image_write(f->path, f->buffer, render->width, render->height);
+
+    free(f->buffer);
+    f->buffer = NULL;
+    stats3D_log_frame(0.0);
+
+    Cam3D cam;
+    if (f->animated && f[1].scene == f->scene) {
+        batch->update(f->scene, 1);
+        cam = f->scene->cam;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->status |= status;
+    --batch->inflight;
+    ++batch->finished;
+    if (f->animated && f[1].scene == f->scene) {
+        f[1].cam = cam;
+        f[1].ready = true;
+    }
+    pthread_cond_broadcast(&batch->cond);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void* batch_worker(void* arg)
+{
+    Batch* batch = arg;
+    const Render3D* render = batch->render;
+    const uint32_t size = TRACY_TILE_SIZE;
+
+    pthread_mutex_lock(&batch->lock);
+    cpu3D_pin(batch->slots++);
+    while (batch->finished < batch->frame_count) {
+
+        BatchFrame* f = batch->open_count ? batch->open[0] : NULL;
+        if (!f && batch->inflight < batch->max_inflight && (f = batch_next(batch))) {
+            f->opened = true;
+            f->buffer = calloc((size_t)render->width * render->height * 4, sizeof(uint8_t));
+            batch->open[batch->open_count++] = f;
+            ++batch->inflight;
+        }
+
+        if (!f) {
+            pthread_cond_wait(&batch->cond, &batch->lock);
+            continue;
+        }
+
+        /* tiles are handed out from the oldest open frame first */
+        const uint32_t tile = f->next_tile++;
+        if (f->next_tile == batch->tile_count) {
+            memmove(batch->open, batch->open + 1, --batch->open_count * sizeof(BatchFrame*));
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        const uint32_t x0 = (tile % batch->tiles_x) * size, y0 = (tile / batch->tiles_x) * size;
+        const uint32_t x1 = x0 + size < render->width ? x0 + size : render->width;
+        const uint32_t y1 = y0 + size < render->height ? y0 + size : render->height;
+        const double time = time_clock();
+        render3D_tile(render, f->scene, &f->cam, f->buffer, x0, y0, x1, y1);
+        stats3D_local()->busy += time_clock() - time;
+
+        pthread_mutex_lock(&batch->lock);
+        if (++f->done_tiles == batch->tile_count) {
+            pthread_mutex_unlock(&batch->lock);
+            batch_finish(batch, f);
+            pthread_mutex_lock(&batch->lock);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+int render3D_batch(const Render3D* render, Scene3D** scenes, const size_t scene_count, const char* const* paths, const uint32_t inflight, Update3D update)
+{
+    const uint32_t frames = render->frames;
+    const uint32_t size = TRACY_TILE_SIZE;
+
+    Batch batch;
+    batch.render = render;
+    batch.update = update;
+    batch.frame_count = scene_count * frames;
+    batch.frames = malloc(sizeof(BatchFrame) * (batch.frame_count + 1));
+    batch.open = malloc(sizeof(BatchFrame*) * (inflight ? inflight : 1));
+    batch.finished = 0;
+    batch.cursor = 0;
+    batch.open_count = 0;
+    batch.inflight = 0;
+    batch.max_inflight = inflight ? inflight : 1;
+    batch.tiles_x = (render->width + size - 1) / size;
+    batch.tile_count = batch.tiles_x * ((render->height + size - 1) / size);
+    batch.slots = 0;
+    batch.status = EXIT_SUCCESS;
+
+    /* cameras of static scenes are known up front, so their frames can overlap */
+    for (size_t i = 0; i < scene_count; ++i) {
+        const bool animated = scene3D_animated(scenes[i]);
+        for (uint32_t j = 0; j < frames; ++j) {
+            BatchFrame* f = batch.frames + i * frames + j;
+            f->scene = scenes[i];
+            f->path = paths[i * frames + j];
+            f->buffer = NULL;
+            f->index = j;
+            f->next_tile = 0;
+            f->done_tiles = 0;
+            f->opened = false;
+            f->animated = animated;
+            f->ready = !animated || !j;
+            if (f->ready) {
+                if (j) {
+                    update(scenes[i], 1);
+                }
+                f->cam = scenes[i]->cam;
+            }
+        }
+    }
+    batch.frames[batch.frame_count].scene = NULL;
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+
+    const uint32_t thread_count = render->threads ? render->threads : 1;
+    pthread_t threads[thread_count];
+    for (uint32_t i = 0; i + 1 < thread_count; ++i) {
+        pthread_create(threads + i, NULL, &batch_worker, &batch);
+    }
+
+    batch_worker(&batch);
+    cpu3D_unpin();
+
+    for (uint32_t i = 0; i + 1 < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&batch.cond);
+    pthread_mutex_destroy(&batch.lock);
+    free(batch.frames);
+    free(batch.open);
+    return batch.status;
+}
@@ -0,0 +1,231 @@
+#include <tracy.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * tracy binary scene (.scb)
+ *
+ * header | materials | spheres | sphere materials | triangles |
+ * triangle materials | model table | model animations | model triangles...
+ *
+ * Every section starts at a TRACY_BINARY_ALIGN aligned offset and holds the
+ * exact in-memory representation of its array, so a mapped file can be used
+ * in place without parsing or copying. The header stores the size of every
+ * element type to reject files written by an incompatible build. Models are
+ * stored in their rest pose, next to their velocity and spin.
+ */
+
+#define TRACY_BINARY_ALIGN 64
+#define TRACY_BINARY_ALIGNED(n) (((n) + TRACY_BINARY_ALIGN - 1) & ~(uint64_t)(TRACY_BINARY_ALIGN - 1))
+
+static const char binary_magic[8] = {'T', 'R', 'A', 'C', 'Y', 'S', 'C', 'B'};
+
+typedef struct BinarySection {
+    uint64_t offset;
+    uint64_t count;
+} BinarySection;
+
+typedef struct BinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t size_index;
+    uint32_t size_material;
+    uint32_t size_sphere;
+    uint32_t size_triangle;
+    uint32_t size_anim;
+    vec3 lookfrom;
+    vec3 lookat;
+    vec3 up;
+    vec3 background;
+    float fov;
+    float aperture;
+    float focus;
+    float reserved_camera;
+    BinarySection materials;
+    BinarySection spheres;
+    BinarySection sphere_materials;
+    BinarySection triangles;
+    BinarySection triangle_materials;
+    BinarySection models;
+    BinarySection anims;
+} BinaryHeader;
+
+static struct vector vector_view(void* data, const size_t bytes, const size_t count)
+{
+    struct vector v = vector_create(bytes);
+    if (count) {
+        v.data = data;
+        v.size = count;
+        v.capacity = count;
+    }
+    return v;
+}
+
+static bool binary_section_valid(const BinarySection* section, const size_t bytes, const size_t size)
+{
+    return !(section->offset % TRACY_BINARY_ALIGN) && section->offset <= size &&
+        section->count <= (size - section->offset) / bytes;
+}
+
+static bool binary_header_valid(const BinaryHeader* header, const size_t size)
+{
+    return size >= sizeof(BinaryHeader) &&
+        !memcmp(header->magic, binary_magic, sizeof(binary_magic)) &&
+        header->version == TRACY_BINARY_VERSION &&
+        header->size_index == sizeof(size_t) &&
+        header->size_material == sizeof(Material) &&
+        header->size_sphere == sizeof(Sphere) &&
+        header->size_triangle == sizeof(Tri3D) &&
+        header->size_anim == sizeof(Anim3D) &&
+        binary_section_valid(&header->materials, sizeof(Material), size) &&
+        binary_section_valid(&header->spheres, sizeof(Sphere), size) &&
+        binary_section_valid(&header->sphere_materials, sizeof(size_t), size) &&
+        binary_section_valid(&header->triangles, sizeof(Tri3D), size) &&
+        binary_section_valid(&header->triangle_materials, sizeof(size_t), size) &&
+        binary_section_valid(&header->models, sizeof(BinarySection), size) &&
+        binary_section_valid(&header->anims, sizeof(Anim3D), size) &&
+        header->anims.count == header->models.count &&
+        header->spheres.count == header->sphere_materials.count &&
+        header->triangles.count == header->triangle_materials.count;
+}
+
+bool scene3D_is_binary(const void* data, const size_t size)
+{
+    return size >= sizeof(binary_magic) && !memcmp(data, binary_magic, sizeof(binary_magic));
+}
+
+Scene3D* scene3D_load_binary(const char* filename, const float aspect, const uint32_t lazy)
+{
+    size_t size;
+    uint8_t* data = file_map(filename, &size);
+    if (!data) {
+        fprintf(stderr, "tracy error: Could not open file '%s'.\n", filename);
+        return NULL;
+    }
+
+    const BinaryHeader* header = (BinaryHeader*)data;
+    if (!binary_header_valid(header, size)) {
+        fprintf(stderr, "tracy error: File '%s' is not a valid version %d tracy binary scene.\n", filename, TRACY_BINARY_VERSION);
+        file_unmap(data, size);
+        return NULL;
+    }
+
+    Scene3D* scene = scene3D_new();
+    scene->map = data;
+    scene->map_size = size;
+    scene->background_color = header->background;
+    scene->materials = vector_view(data + header->materials.offset, sizeof(Material), header->materials.count);
+    scene->spheres = vector_view(data + header->spheres.offset, sizeof(Sphere), header->spheres.count);
+    scene->sphere_materials = vector_view(data + header->sphere_materials.offset, sizeof(size_t), header->sphere_materials.count);
+    scene->triangles = vector_view(data + header->triangles.offset, sizeof(Tri3D), header->triangles.count);
+    scene->triangle_materials = vector_view(data + header->triangle_materials.offset, sizeof(size_t), header->triangle_materials.count);
+
+    const BinarySection* sections = (BinarySection*)(data + header->models.offset);
+    const Anim3D* anims = (Anim3D*)(data + header->anims.offset);
+    for (size_t i = 0; i < header->models.count; ++i) {
+        if (!sections[i].count || !binary_section_valid(sections + i, sizeof(Tri3D), size)) {
+            fprintf(stderr, "tracy error: Invalid model section in binary scene '%s'.\n", filename);
+            continue;
+        }
+
+        Model3D* model = model3D_new(vector_view(data + sections[i].offset, sizeof(Tri3D), sections[i].count));
+        model->anim = anims[i];
+        model->lazy = lazy;
+        model3D_rebuild(model);
+        vector_push(&scene->models, &model);
+    }
+
+    scene->cam = cam3D_new(header->lookfrom, header->lookat, header->up, header->fov, aspect, header->aperture, header->focus);
+    return scene;
+}
+
+static uint64_t binary_section(BinarySection* section, const uint64_t offset, const size_t bytes, const size_t count)
+{
+    section->offset = TRACY_BINARY_ALIGNED(offset);
+    section->count = count;
+    return section->offset + bytes * count;
+}
+
+static bool binary_write_section(FILE* file, const BinarySection* section, const void* data, const size_t bytes)
+{
+    static const uint8_t zero[TRACY_BINARY_ALIGN] = {0};
+    const long pad = (long)section->offset - ftell(file);
+    if (pad < 0 || (pad && fwrite(zero, pad, 1, file) != 1)) {
+        return false;
+    }
+    return !section->count || fwrite(data, bytes, section->count, file) == section->count;
+}
+
+int scene3D_write_binary(const char* filename, const Scene3D* scene)
+{
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version = TRACY_BINARY_VERSION;
+    header.size_index = sizeof(size_t);
+    header.size_material = sizeof(Material);
+    header.size_sphere = sizeof(Sphere);
+    header.size_triangle = sizeof(Tri3D);
+    header.size_anim = sizeof(Anim3D);
+    header.lookfrom = scene->cam.lookFrom;
+    header.lookat = scene->cam.lookAt;
+    header.up = scene->cam.up;
+    header.background = scene->background_color;
+    header.fov = scene->cam.fov;
+    header.aperture = scene->cam.aperture;
+    header.focus = scene->cam.focusDist;
+
+    uint64_t offset = sizeof(BinaryHeader);
+    offset = binary_section(&header.materials, offset, sizeof(Material), scene->materials.size);
+    offset = binary_section(&header.spheres, offset, sizeof(Sphere), scene->spheres.size);
+    offset = binary_section(&header.sphere_materials, offset, sizeof(size_t), scene->sphere_materials.size);
+    offset = binary_section(&header.triangles, offset, sizeof(Tri3D), scene->triangles.size);
+    offset = binary_section(&header.triangle_materials, offset, sizeof(size_t), scene->triangle_materials.size);
+    offset = binary_section(&header.models, offset, sizeof(BinarySection), scene->models.size);
+    offset = binary_section(&header.anims, offset, sizeof(Anim3D), scene->models.size);
+
+    /* animations start over from the rest pose when the scene is loaded */
+    const size_t model_count = scene->models.size;
+    Model3D** models = scene->models.data;
+    BinarySection* sections = malloc(sizeof(BinarySection) * (model_count + 1));
+    Anim3D* anims = malloc(sizeof(Anim3D) * (model_count + 1));
+    const struct vector** meshes = malloc(sizeof(struct vector*) * (model_count + 1));
+    for (size_t i = 0; i < model_count; ++i) {
+        meshes[i] = models[i]->rest.size ? &models[i]->rest : &models[i]->triangles;
+        anims[i] = models[i]->anim;
+        offset = binary_section(sections + i, offset, sizeof(Tri3D), meshes[i]->size);
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        free(sections);
+        free(anims);
+        free(meshes);
+        return tracy_error("Could not write file '%s'.\n", filename);
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        binary_write_section(file, &header.materials, scene->materials.data, sizeof(Material)) &&
+        binary_write_section(file, &header.spheres, scene->spheres.data, sizeof(Sphere)) &&
+        binary_write_section(file, &header.sphere_materials, scene->sphere_materials.data, sizeof(size_t)) &&
+        binary_write_section(file, &header.triangles, scene->triangles.data, sizeof(Tri3D)) &&
+        binary_write_section(file, &header.triangle_materials, scene->triangle_materials.data, sizeof(size_t)) &&
+        binary_write_section(file, &header.models, sections, sizeof(BinarySection)) &&
+        binary_write_section(file, &header.anims, anims, sizeof(Anim3D));
+
+    for (size_t i = 0; ok && i < model_count; ++i) {
+        ok = binary_write_section(file, sections + i, meshes[i]->data, sizeof(Tri3D));
+    }
+
+    fclose(file);
+    free(sections);
+    free(anims);
+    free(meshes);
+
+    if (!ok) {
+        return tracy_error("Failed writing binary scene '%s'.\n", filename);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+#include <tracy.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * render contexts own a pool of worker threads and render one frame at a
+ * time without blocking the caller. Frames are split into tiles handed out
+ * through an atomic counter; cancellation is checked before every tile, so
+ * a cancelled render stops after the tiles already being traced. The tile
+ * callback runs on worker threads with a view into the caller's buffer,
+ * concurrently for different tiles.
+ */
+
+struct Context3D {
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;
+    pthread_cond_t finished;
+    pthread_t* threads;
+    uint32_t thread_count;
+    uint32_t slots;
+    Render3D render;
+    const Scene3D* scene;
+    TileCallback3D callback;
+    void* userdata;
+    uint32_t tiles_x;
+    uint32_t tile_count;
+    uint32_t next_tile;
+    uint32_t done_tiles;
+    uint32_t active;
+    uint32_t generation;
+    int cancel;
+    int status;
+    bool busy;
+    bool quit;
+};
+
+static void context3D_run(Context3D* ctx)
+{
+    const Render3D* render = &ctx->render;
+    const uint32_t size = TRACY_TILE_SIZE;
+
+    while (!__atomic_load_n(&ctx->cancel, __ATOMIC_ACQUIRE)) {
+        const uint32_t tile = __atomic_fetch_add(&ctx->next_tile, 1, __ATOMIC_RELAXED);
+        if (tile >= ctx->tile_count) {
+            break;
+        }
+
+        const uint32_t x0 = (tile % ctx->tiles_x) * size, y0 = (tile / ctx->tiles_x) * size;
+        const uint32_t x1 = x0 + size < render->width ? x0 + size : render->width;
+        const uint32_t y1 = y0 + size < render->height ? y0 + size : render->height;
+        const double time = time_clock();
+        render3D_tile(render, ctx->scene, &ctx->scene->cam, render->buffer, x0, y0, x1, y1);
+        stats3D_local()->busy += time_clock() - time;
+
+        const uint32_t done = __atomic_add_fetch(&ctx->done_tiles, 1, __ATOMIC_ACQ_REL);
+        if (ctx->callback) {
+            const Tile3D view = {
+                render->buffer + ((size_t)y0 * render->width + x0) * 4,
+                render->width * 4, x0, y0, x1 - x0, y1 - y0, done, ctx->tile_count
+            };
+            ctx->callback(&view, ctx->userdata);
+        }
+    }
+}
+
+static void* context3D_worker(void* arg)
+{
+    Context3D* ctx = arg;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    cpu3D_pin(ctx->slots++);
+    while (true) {
+        while (!ctx->quit && ctx->generation == generation) {
+            pthread_cond_wait(&ctx->submitted, &ctx->lock);
+        }
+
+        if (ctx->quit) {
+            break;
+        }
+
+        generation = ctx->generation;
+        ++ctx->active;
+        pthread_mutex_unlock(&ctx->lock);
+
+        context3D_run(ctx);
+
+        /* the last worker out completes the frame, every claimed tile is done by then */
+        pthread_mutex_lock(&ctx->lock);
+        if (!--ctx->active) {
+            if (ctx->busy) {
+                ctx->status = ctx->done_tiles < ctx->tile_count ? TRACY_RENDER_CANCELLED : EXIT_SUCCESS;
+                ctx->busy = false;
+            }
+            pthread_cond_broadcast(&ctx->finished);
+        }
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+Context3D* context3D_create(const uint32_t threads)
+{
+    Context3D* ctx = malloc(sizeof(Context3D));
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->submitted, NULL);
+    pthread_cond_init(&ctx->finished, NULL);
+
+    ctx->thread_count = threads ? threads : 1;
+    ctx->slots = 0;
+    ctx->scene = NULL;
+    ctx->callback = NULL;
+    ctx->userdata = NULL;
+    ctx->tiles_x = 0;
+    ctx->tile_count = 0;
+    ctx->next_tile = 0;
+    ctx->done_tiles = 0;
+    ctx->active = 0;
+    ctx->generation = 0;
+    ctx->cancel = 0;
+    ctx->status = EXIT_SUCCESS;
+    ctx->busy = false;
+    ctx->quit = false;
+
+    ctx->threads = malloc(sizeof(pthread_t) * ctx->thread_count);
+    for (uint32_t i = 0; i < ctx->thread_count; ++i) {
+        pthread_create(ctx->threads + i, NULL, &context3D_worker, ctx);
+    }
+
+    return ctx;
+}
+
+int context3D_submit(Context3D* ctx, const Render3D* render, const Scene3D* scene, TileCallback3D callback, void* userdata)
+{
+    const uint32_t size = TRACY_TILE_SIZE;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->busy || !render->buffer) {
+        pthread_mutex_unlock(&ctx->lock);
+        return EXIT_FAILURE;
+    }
+
+    /* workers that woke up late for the previous frame must be out of it */
+    while (ctx->active) {
+        pthread_cond_wait(&ctx->finished, &ctx->lock);
+    }
+
+    ctx->render = *render;
+    ctx->scene = scene;
+    ctx->callback = callback;
+    ctx->userdata = userdata;
+    ctx->tiles_x = (render->width + size - 1) / size;
+    ctx->tile_count = ctx->tiles_x * ((render->height + size - 1) / size);
+    ctx->next_tile = 0;
+    ctx->done_tiles = 0;
+    ctx->cancel = 0;
+    ctx->busy = true;
+    ++ctx->generation;
+    pthread_cond_broadcast(&ctx->submitted);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return EXIT_SUCCESS;
+}
+
+void context3D_cancel(Context3D* ctx)
+{
+    __atomic_store_n(&ctx->cancel, 1, __ATOMIC_RELEASE);
+}
+
+float context3D_progress(const Context3D* ctx)
+{
+    const uint32_t count = ctx->tile_count;
+    return count ? (float)__atomic_load_n(&ctx->done_tiles, __ATOMIC_ACQUIRE) / (float)count : 1.0f;
+}
+
+bool context3D_busy(Context3D* ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    const bool busy = ctx->busy;
+    pthread_mutex_unlock(&ctx->lock);
+    return busy;
+}
+
+int context3D_wait(Context3D* ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    while (ctx->busy) {
+        pthread_cond_wait(&ctx->finished, &ctx->lock);
+    }
+    const int status = ctx->status;
+    pthread_mutex_unlock(&ctx->lock);
+    return status;
+}
+
+void context3D_free(Context3D* ctx)
+{
+    context3D_cancel(ctx);
+    context3D_wait(ctx);
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->quit = true;
+    pthread_cond_broadcast(&ctx->submitted);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (uint32_t i = 0; i < ctx->thread_count; ++i) {
+        pthread_join(ctx->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&ctx->submitted);
+    pthread_cond_destroy(&ctx->finished);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->threads);
+    free(ctx);
+}
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include <tracy.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+/*
+ * cpu topology
+ *
+ * The cpus this process may run on are read once from its affinity mask and
+ * sorted by numa node, so worker slots fill one node before the next and the
+ * consecutive slots that render neighbouring rows share a node. Pinning is
+ * off unless enabled. A pinned worker is the first to touch the rows it
+ * renders, which places those framebuffer pages on its node. Without the
+ * linux affinity calls every cpu is on node 0 and pinning does nothing.
+ */
+
+#define CPU_MAX_COUNT 1024
+
+typedef struct CpuSlot3D {
+    uint32_t cpu;
+    uint32_t node;
+} CpuSlot3D;
+
+static CpuSlot3D cpu3D_slots[CPU_MAX_COUNT];
+static uint32_t cpu3D_slot_count = 1;
+static uint32_t cpu3D_node_count = 1;
+static pthread_once_t cpu3D_once = PTHREAD_ONCE_INIT;
+static bool cpu3D_pinned = false;
+
+#ifdef __linux__
+
+/* the node of a cpu is the nodeN link in its sysfs directory */
+static uint32_t cpu3D_read_node(const uint32_t cpu)
+{
+    char path[64];
+    sprintf(path, "/sys/devices/system/cpu/cpu%u", cpu);
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+
+    uint32_t node = 0;
+    const struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (!strncmp(entry->d_name, "node", 4) && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = (uint32_t)atoi(entry->d_name + 4);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return node;
+}
+
+static int cpu3D_cmp(const void* a, const void* b)
+{
+    const CpuSlot3D* x = a, *y = b;
+    if (x->node != y->node) {
+        return x->node < y->node ? -1 : 1;
+    }
+    return (x->cpu > y->cpu) - (x->cpu < y->cpu);
+}
+
+static void cpu3D_init(void)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set)) {
+        cpu3D_slots[0].cpu = 0;
+        cpu3D_slots[0].node = 0;
+        return;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE && count < CPU_MAX_COUNT; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpu3D_slots[count].cpu = cpu;
+            cpu3D_slots[count].node = cpu3D_read_node(cpu);
+            ++count;
+        }
+    }
+
+    if (!count) {
+        return;
+    }
+
+    /* sparse node ids become 0, 1, 2... in the order they sort */
+    qsort(cpu3D_slots, count, sizeof(CpuSlot3D), &cpu3D_cmp);
+    uint32_t node = 0, id = cpu3D_slots[0].node;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (cpu3D_slots[i].node != id) {
+            id = cpu3D_slots[i].node;
+            ++node;
+        }
+        cpu3D_slots[i].node = node;
+    }
+
+    cpu3D_slot_count = count;
+    cpu3D_node_count = node + 1;
+}
+
+#else
+
+static void cpu3D_init(void)
+{
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu3D_slot_count = count > 0 ? (count < CPU_MAX_COUNT ? (uint32_t)count : CPU_MAX_COUNT) : 1;
+    for (uint32_t i = 0; i < cpu3D_slot_count; ++i) {
+        cpu3D_slots[i].cpu = i;
+        cpu3D_slots[i].node = 0;
+    }
+}
+
+#endif
+
+/* cpus in the affinity mask the process started with */
+uint32_t cpu3D_count(void)
+{
+    pthread_once(&cpu3D_once, &cpu3D_init);
+    return cpu3D_slot_count;
+}
+
+uint32_t cpu3D_nodes(void)
+{
+    pthread_once(&cpu3D_once, &cpu3D_init);
+    return cpu3D_node_count;
+}
+
+/* numa node of a worker slot, slots past the cpu count wrap around */
+uint32_t cpu3D_node(const uint32_t slot)
+{
+    pthread_once(&cpu3D_once, &cpu3D_init);
+    return cpu3D_slots[slot % cpu3D_slot_count].node;
+}
+
+/* first worker slot on a node */
+uint32_t cpu3D_node_slot(const uint32_t node)
+{
+    pthread_once(&cpu3D_once, &cpu3D_init);
+    uint32_t slot = 0;
+    while (slot + 1 < cpu3D_slot_count && cpu3D_slots[slot].node < node) {
+        ++slot;
+    }
+    return slot;
+}
+
+void cpu3D_pinning(const bool enable)
+{
+    pthread_once(&cpu3D_once, &cpu3D_init);
+    cpu3D_pinned = enable;
+}
+
+/* binds the calling thread to the cpu of a worker slot */
+void cpu3D_pin(const uint32_t slot)
+{
+    if (!cpu3D_pinned) {
+        return;
+    }
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu3D_slots[slot % cpu3D_slot_count].cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)slot;
+#endif
+}
+
+/* lets a pinned thread run on every cpu again, threads it creates inherit its mask */
+void cpu3D_unpin(void)
+{
+    if (!cpu3D_pinned) {
+        return;
+    }
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t i = 0; i < cpu3D_slot_count; ++i) {
+        CPU_SET(cpu3D_slots[i].cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
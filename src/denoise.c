@@ -0,0 +1,228 @@
+#include <tracy.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * edge avoiding a-trous wavelet filter (Dammertz et al. 2010)
+ *
+ * The color aov is divided by albedo and the remaining irradiance is
+ * filtered with a 5x5 B3 spline kernel whose taps spread out by a factor of
+ * two every iteration. Tap weights fall off with differences in normal,
+ * albedo and relative depth, and with luminance differences relative to a
+ * spatial variance estimate that is filtered along with the color, as in
+ * SVGF, so single bright samples do not stop the filter. The albedo is
+ * multiplied back in at the end.
+ */
+
+#define DENOISE_SIGMA_LUMINANCE 4.0f
+#define DENOISE_SIGMA_ALBEDO 0.1f
+#define DENOISE_SIGMA_DEPTH 0.05f
+#define DENOISE_EPSILON 1e-3f
+
+typedef struct DenoiseJob {
+    const Render3D* render;
+    const float* src;
+    float* dst;
+    uint32_t start;
+    uint32_t end;
+    uint32_t step;
+} DenoiseJob;
+
+static const float denoise_kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+static inline float denoise_luminance(const float* c)
+{
+    return 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+}
+
+/* 3x3 gaussian of the variance channel around x, y */
+static float denoise_variance(const float* src, const int x, const int y, const int width, const int height)
+{
+    static const float kernel[2][2] = {{1.0f / 4.0f, 1.0f / 8.0f}, {1.0f / 8.0f, 1.0f / 16.0f}};
+    float sum = 0.0f, total = 0.0f;
+    for (int j = -1; j <= 1; ++j) {
+        for (int i = -1; i <= 1; ++i) {
+            const int qx = x + i, qy = y + j;
+            if (qx >= 0 && qx < width && qy >= 0 && qy < height) {
+                const float k = kernel[j * j][i * i];
+                sum += src[((size_t)qy * width + qx) * 4 + 3] * k;
+                total += k;
+            }
+        }
+    }
+    return sum / total;
+}
+
+/* luminance variance of the 3x3 neighbourhood, written to the fourth channel of dst */
+static void* denoise3D_variance_job(void* arg)
+{
+    const DenoiseJob* job = arg;
+    const uint32_t width = job->render->width, height = job->render->height;
+    float* a = job->dst;
+
+    for (uint32_t y = job->start; y < job->end; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            float m1 = 0.0f, m2 = 0.0f, n = 0.0f;
+            for (uint32_t qy = y ? y - 1 : 0; qy <= y + 1 && qy < height; ++qy) {
+                for (uint32_t qx = x ? x - 1 : 0; qx <= x + 1 && qx < width; ++qx) {
+                    const float l = denoise_luminance(a + ((size_t)qy * width + qx) * 4);
+                    m1 += l;
+                    m2 += l * l;
+                    n += 1.0f;
+                }
+            }
+            m1 /= n;
+            m2 /= n;
+            a[((size_t)y * width + x) * 4 + 3] = m2 - m1 * m1 > 0.0f ? m2 - m1 * m1 : 0.0f;
+        }
+    }
+
+    return NULL;
+}
+
+static inline float denoise_normal_weight(const float* n, const float* m)
+{
+    float d = n[0] * m[0] + n[1] * m[1] + n[2] * m[2];
+    d = d > 0.0f ? d : 0.0f;
+    for (int i = 0; i < 6; ++i) {
+        d *= d; /* d^64 */
+    }
+    return d;
+}
+
+static void* denoise3D_job(void* arg)
+{
+    const DenoiseJob* job = arg;
+    const Render3D* render = job->render;
+    const int width = (int)render->width, height = (int)render->height;
+    const int step = (int)job->step;
+    const float* depth = render->aov[TRACY_AOV_DEPTH];
+    const float* normal = render->aov[TRACY_AOV_NORMAL];
+    const float* albedo = render->aov[TRACY_AOV_ALBEDO];
+    const float* src = job->src;
+    const float invAlbedo = 1.0f / (DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO);
+
+    for (int y = (int)job->start; y < (int)job->end; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const size_t p = (size_t)y * width + x;
+            const float* cp = src + p * 4;
+            const float* np = normal + p * 3;
+            const float* ap = albedo + p * 3;
+            const float dp = depth[p];
+            const float lp = denoise_luminance(cp);
+            const float invDepth = 1.0f / (DENOISE_SIGMA_DEPTH * dp * step + DENOISE_EPSILON);
+            const float invLum = 1.0f / (DENOISE_SIGMA_LUMINANCE * sqrtf(denoise_variance(src, x, y, width, height)) + DENOISE_EPSILON);
+
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f}, total = 0.0f;
+            for (int j = -2; j <= 2; ++j) {
+                const int qy = y + j * step;
+                if (qy < 0 || qy >= height) {
+                    continue;
+                }
+
+                for (int i = -2; i <= 2; ++i) {
+                    const int qx = x + i * step;
+                    if (qx < 0 || qx >= width) {
+                        continue;
+                    }
+
+                    const size_t q = (size_t)qy * width + qx;
+                    const float* cq = src + q * 4;
+                    const float* aq = albedo + q * 3;
+
+                    const float dl = lp - denoise_luminance(cq);
+                    const float da0 = ap[0] - aq[0], da1 = ap[1] - aq[1], da2 = ap[2] - aq[2];
+                    const float dz = dp - depth[q];
+
+                    const float e = (dl < 0.0f ? -dl : dl) * invLum +
+                        (da0 * da0 + da1 * da1 + da2 * da2) * invAlbedo +
+                        (dz < 0.0f ? -dz : dz) * invDepth;
+
+                    const float w = denoise_kernel[i + 2] * denoise_kernel[j + 2] * expf(-e) * denoise_normal_weight(np, normal + q * 3);
+                    sum[0] += cq[0] * w;
+                    sum[1] += cq[1] * w;
+                    sum[2] += cq[2] * w;
+                    sum[3] += cq[3] * w * w;
+                    total += w;
+                }
+            }
+
+            /* degenerate normals can reject every tap, including the center */
+            float* out = job->dst + p * 4;
+            if (total > 0.0f) {
+                const float inv = 1.0f / total;
+                out[0] = sum[0] * inv;
+                out[1] = sum[1] * inv;
+                out[2] = sum[2] * inv;
+                out[3] = sum[3] * inv * inv;
+            }
+            else memcpy(out, cp, sizeof(float) * 4);
+        }
+    }
+
+    return NULL;
+}
+
+static void denoise3D_pass(const Render3D* render, const float* src, float* dst, const uint32_t step, void* (*func)(void*))
+{
+    const uint32_t thread_count = render->threads ? render->threads : 1;
+    const uint32_t chunk = render->height / thread_count;
+
+    pthread_t threads[thread_count];
+    DenoiseJob jobs[thread_count];
+
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        jobs[i] = (DenoiseJob){render, src, dst, i * chunk, i + 1 < thread_count ? (i + 1) * chunk : render->height, step};
+        if (i + 1 < thread_count) {
+            pthread_create(threads + i, NULL, func, jobs + i);
+        }
+    }
+
+    func(jobs + thread_count - 1);
+
+    for (uint32_t i = 0; i + 1 < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+void denoise3D(const Render3D* render, const uint32_t iterations)
+{
+    if ((render->aovs & TRACY_DENOISE_FEATURES) != TRACY_DENOISE_FEATURES) {
+        return;
+    }
+
+    const double start = timeline3D_begin();
+    const uint32_t width = render->width, height = render->height;
+    const size_t pixels = (size_t)width * height;
+    float* color = render->aov[TRACY_AOV_COLOR];
+    const float* albedo = render->aov[TRACY_AOV_ALBEDO];
+    float* a = malloc(sizeof(float) * pixels * 4);
+    float* b = malloc(sizeof(float) * pixels * 4);
+
+    for (size_t i = 0; i < pixels; ++i) {
+        a[i * 4 + 0] = color[i * 3 + 0] / (albedo[i * 3 + 0] + DENOISE_EPSILON);
+        a[i * 4 + 1] = color[i * 3 + 1] / (albedo[i * 3 + 1] + DENOISE_EPSILON);
+        a[i * 4 + 2] = color[i * 3 + 2] / (albedo[i * 3 + 2] + DENOISE_EPSILON);
+    }
+
+    /* luminance variance seeds the color weights, it only reads the color channels */
+    denoise3D_pass(render, a, a, 0, &denoise3D_variance_job);
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+        denoise3D_pass(render, a, b, 1u << i, &denoise3D_job);
+        float* tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    for (size_t i = 0; i < pixels; ++i) {
+        color[i * 3 + 0] = a[i * 4 + 0] * (albedo[i * 3 + 0] + DENOISE_EPSILON);
+        color[i * 3 + 1] = a[i * 4 + 1] * (albedo[i * 3 + 1] + DENOISE_EPSILON);
+        color[i * 3 + 2] = a[i * 4 + 2] * (albedo[i * 3 + 2] + DENOISE_EPSILON);
+    }
+
+    free(a);
+    free(b);
+    timeline3D_end("denoise", start, -1, -1);
+}
@@ -0,0 +1,676 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ * distributed rendering
+ *
+ * A coordinator partitions every frame into tiles and sample ranges (passes)
+ * and hands them to worker processes over a unix or tcp socket. Workers load
+ * the same scenes themselves and answer each unit with the sums of its
+ * linear radiance samples. Every unit lands in its own slot of a per pass
+ * float buffer and passes are summed in a fixed order once the frame is
+ * complete, so the result does not depend on which worker rendered what.
+ * Each unit carries a seed derived from its scene, frame and index, and
+ * workers seed every row from it, so units never share samples and every
+ * copy of a unit renders the same ones.
+ *
+ * Units of a worker that disconnects are issued again. When nothing new is
+ * left to issue, idle workers get a second copy of the oldest outstanding
+ * unit, so a slow worker cannot hold back the end of a frame. The first
+ * result of a unit wins, later copies are dropped.
+ *
+ * Messages use native byte order and layout: workers must run the same
+ * build of tracy on the same kind of machine as the coordinator.
+ */
+
+#define DIST_MAGIC 0x59435254
+#define DIST_TILE_SIZE 64
+#define DIST_DEPTH 2
+#define DIST_COPIES 2
+#define DIST_RETRIES 30
+
+enum {
+    DIST_HELLO,
+    DIST_WORK,
+    DIST_RESULT,
+    DIST_DONE
+};
+
+typedef struct DistMessage {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t unit;
+    uint32_t scene;
+    uint32_t frame;
+    uint32_t width;
+    uint32_t height;
+    uint32_t spp;
+    uint32_t x0, y0, x1, y1;
+    uint64_t seed; /* of the unit, copies of a unit render the same samples */
+} DistMessage;
+
+typedef struct DistUnit {
+    uint32_t x0, y0, x1, y1;
+    uint32_t pass;
+    uint32_t spp;
+    uint32_t copies;
+    double issued;
+    bool done;
+} DistUnit;
+
+typedef struct DistWorker {
+    int fd;
+    uint32_t threads;
+    DistMessage queue[DIST_DEPTH];
+    uint32_t queued;
+    uint32_t units;
+    uint64_t samples;
+    double joined;
+    double left;
+    bool hello;
+    bool alive;
+} DistWorker;
+
+static bool dist_send(const int fd, const void* data, size_t size)
+{
+    const uint8_t* p = data;
+    while (size) {
+        const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool dist_recv(const int fd, void* data, size_t size)
+{
+    uint8_t* p = data;
+    while (size) {
+        const ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/* "unix:<path>" or anything with a '/' is a unix socket, otherwise "<host>:<port>" */
+static int dist_socket(const char* address, const bool server)
+{
+    const char* path = !strncmp(address, "unix:", 5) ? address + 5 : strchr(address, '/') ? address : NULL;
+    if (path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (server) {
+            unlink(path);
+        }
+        if (server ? bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 64) : connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    const char* colon = strrchr(address, ':');
+    if (!colon) {
+        return -1;
+    }
+
+    char host[256];
+    const size_t len = (size_t)(colon - address);
+    if (len >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, address, len);
+    host[len] = 0;
+
+    struct addrinfo hints, *info, *it;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    const bool any = !len || !strcmp(host, "*");
+    if (getaddrinfo(any ? NULL : host, colon + 1, &hints, &info)) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (it = info; it; it = it->ai_next) {
+        fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (server) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (server ? !bind(fd, it->ai_addr, it->ai_addrlen) && !listen(fd, 64) : !connect(fd, it->ai_addr, it->ai_addrlen)) {
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(info);
+    return fd;
+}
+
+/* worker */
+
+typedef struct DistJob {
+    const Render3D* render;
+    const Scene3D* scene;
+    const DistMessage* msg;
+    float* accum;
+    uint32_t y0;
+    uint32_t y1;
+} DistJob;
+
+static void* dist_render_job(void* arg)
+{
+    const DistJob* job = arg;
+    const DistMessage* msg = job->msg;
+    const double time = time_clock();
+    render3D_tile_accum(job->render, job->scene, &job->scene->cam, job->accum, msg->x0, job->y0, msg->x1, job->y1, msg->spp, msg->seed);
+    stats3D_local()->busy += time_clock() - time;
+    return NULL;
+}
+
+static void dist_render(const Render3D* render, const Scene3D* scene, const DistMessage* msg, float* accum)
+{
+    const uint32_t rows = msg->y1 - msg->y0;
+    const uint32_t thread_count = render->threads < rows ? render->threads : rows;
+    const uint32_t chunk = rows / thread_count;
+    const size_t stride = (size_t)(msg->x1 - msg->x0) * 3;
+
+    pthread_t threads[thread_count];
+    DistJob jobs[thread_count];
+
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        const uint32_t y0 = msg->y0 + i * chunk;
+        const uint32_t y1 = i + 1 < thread_count ? y0 + chunk : msg->y1;
+        jobs[i] = (DistJob){render, scene, msg, accum + (y0 - msg->y0) * stride, y0, y1};
+        if (i + 1 < thread_count) {
+            pthread_create(threads + i, NULL, &dist_render_job, jobs + i);
+        }
+    }
+
+    dist_render_job(jobs + thread_count - 1);
+
+    for (uint32_t i = 0; i + 1 < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int dist3D_work(const Render3D* render, Scene3D** scenes, const size_t scene_count, const char* address, Update3D update)
+{
+    int fd = dist_socket(address, false);
+    for (uint32_t i = 0; fd < 0 && i < DIST_RETRIES; ++i) {
+        sleep(1);
+        fd = dist_socket(address, false);
+    }
+
+    if (fd < 0) {
+        return tracy_error("Could not connect to coordinator '%s'.\n", address);
+    }
+
+    DistMessage msg = {DIST_MAGIC, DIST_HELLO, render->threads, 0, 0, render->width, render->height, render->spp, 0, 0, 0, 0, 0};
+    if (!dist_send(fd, &msg, sizeof(msg))) {
+        close(fd);
+        return tracy_error("Lost connection to coordinator '%s'.\n", address);
+    }
+
+    int status = EXIT_SUCCESS;
+    uint32_t* frames = calloc(scene_count, sizeof(uint32_t));
+    float* accum = NULL;
+    size_t capacity = 0;
+
+    while (dist_recv(fd, &msg, sizeof(msg))) {
+        if (msg.magic != DIST_MAGIC || msg.type == DIST_DONE) {
+            break;
+        }
+
+        if (msg.type != DIST_WORK || msg.scene >= scene_count || msg.frame < frames[msg.scene] ||
+            msg.width != render->width || msg.height != render->height || !msg.spp ||
+            msg.x0 >= msg.x1 || msg.y0 >= msg.y1 || msg.x1 > msg.width || msg.y1 > msg.height) {
+            status = tracy_error("Invalid work from coordinator, workers need the same scenes and -w -h options.\n");
+            break;
+        }
+
+        Scene3D* scene = scenes[msg.scene];
+        while (frames[msg.scene] < msg.frame) {
+            update(scene, render->threads);
+            ++frames[msg.scene];
+        }
+
+        const size_t count = (size_t)(msg.x1 - msg.x0) * (msg.y1 - msg.y0) * 3;
+        if (count > capacity) {
+            capacity = count;
+            accum = realloc(accum, sizeof(float) * capacity);
+        }
+
+        dist_render(render, scene, &msg, accum);
+
+        msg.type = DIST_RESULT;
+        if (!dist_send(fd, &msg, sizeof(msg)) || !dist_send(fd, accum, sizeof(float) * count)) {
+            status = tracy_error("Lost connection to coordinator '%s'.\n", address);
+            break;
+        }
+    }
+
+    close(fd);
+    free(frames);
+    free(accum);
+    return status;
+}
+
+/* coordinator */
+
+typedef struct Dist {
+    const Render3D* render;
+    DistWorker* workers;
+    struct pollfd* fds;
+    DistUnit* units;
+    uint32_t* retry;
+    float* result;
+    uint32_t worker_count;
+    uint32_t worker_capacity;
+    uint32_t alive;
+    uint32_t unit_count;
+    uint32_t retry_count;
+    uint32_t cursor;
+    uint32_t remaining;
+    uint32_t scene;
+    uint32_t frame;
+    uint64_t dropped;
+} Dist;
+
+static void dist_accept(Dist* dist, const int server)
+{
+    const int fd = accept(server, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (dist->worker_count == dist->worker_capacity) {
+        dist->worker_capacity = dist->worker_capacity ? dist->worker_capacity * 2 : 8;
+        dist->workers = realloc(dist->workers, sizeof(DistWorker) * dist->worker_capacity);
+        dist->fds = realloc(dist->fds, sizeof(struct pollfd) * (dist->worker_capacity + 1));
+    }
+
+    DistWorker* w = dist->workers + dist->worker_count++;
+    memset(w, 0, sizeof(DistWorker));
+    w->fd = fd;
+    w->alive = true;
+    w->joined = time_clock();
+    ++dist->alive;
+}
+
+static bool dist_current(const Dist* dist, const DistMessage* msg)
+{
+    return msg->scene == dist->scene && msg->frame == dist->frame && msg->unit < dist->unit_count;
+}
+
+static void dist_drop(Dist* dist, DistWorker* w)
+{
+    for (uint32_t i = 0; i < w->queued; ++i) {
+        const DistMessage* msg = w->queue + i;
+        if (dist_current(dist, msg)) {
+            DistUnit* unit = dist->units + msg->unit;
+            if (!--unit->copies && !unit->done) {
+                dist->retry[dist->retry_count++] = msg->unit;
+            }
+        }
+    }
+
+    close(w->fd);
+    w->queued = 0;
+    w->alive = false;
+    w->left = time_clock();
+    --dist->alive;
+}
+
+static uint32_t dist_find(const DistWorker* w, const DistMessage* msg)
+{
+    uint32_t i = 0;
+    while (i < w->queued && (w->queue[i].unit != msg->unit || w->queue[i].scene != msg->scene || w->queue[i].frame != msg->frame)) {
+        ++i;
+    }
+    return i;
+}
+
+static int64_t dist_pick(Dist* dist, const DistWorker* w)
+{
+    while (dist->retry_count) {
+        const uint32_t u = dist->retry[--dist->retry_count];
+        if (!dist->units[u].done && !dist->units[u].copies) {
+            return u;
+        }
+    }
+
+    if (dist->cursor < dist->unit_count) {
+        return dist->cursor++;
+    }
+
+    /* nothing new to issue, duplicate the oldest unit still out */
+    int64_t best = -1;
+    for (uint32_t u = 0; u < dist->unit_count; ++u) {
+        const DistUnit* unit = dist->units + u;
+        if (unit->done || unit->copies >= DIST_COPIES || (best >= 0 && unit->issued >= dist->units[best].issued)) {
+            continue;
+        }
+
+        const DistMessage msg = {DIST_MAGIC, DIST_WORK, u, dist->scene, dist->frame, 0, 0, 0, 0, 0, 0, 0, 0};
+        if (dist_find(w, &msg) == w->queued) {
+            best = u;
+        }
+    }
+
+    return best;
+}
+
+static void dist_issue(Dist* dist)
+{
+    const Render3D* render = dist->render;
+    for (uint32_t i = 0; i < dist->worker_count; ++i) {
+        DistWorker* w = dist->workers + i;
+        while (w->alive && w->hello && w->queued < DIST_DEPTH) {
+            const int64_t u = dist_pick(dist, w);
+            if (u < 0) {
+                break;
+            }
+
+            DistUnit* unit = dist->units + u;
+            const DistMessage msg = {
+                DIST_MAGIC, DIST_WORK, (uint32_t)u, dist->scene, dist->frame, render->width, render->height,
+                unit->spp, unit->x0, unit->y0, unit->x1, unit->y1,
+                rand3D_hash(rand3D_hash(dist->scene, dist->frame), (uint64_t)u)
+            };
+
+            w->queue[w->queued++] = msg;
+            ++unit->copies;
+            unit->issued = time_clock();
+            if (!dist_send(w->fd, &msg, sizeof(msg))) {
+                dist_drop(dist, w);
+            }
+        }
+    }
+}
+
+static void dist_receive(Dist* dist, DistWorker* w)
+{
+    DistMessage msg;
+    if (!dist_recv(w->fd, &msg, sizeof(msg)) || msg.magic != DIST_MAGIC) {
+        dist_drop(dist, w);
+        return;
+    }
+
+    if (msg.type == DIST_HELLO) {
+        if (msg.width != dist->render->width || msg.height != dist->render->height) {
+            fprintf(stderr, "tracy error: Worker %u renders at %ux%u instead of %ux%u.\n", (uint32_t)(w - dist->workers) + 1, msg.width, msg.height, dist->render->width, dist->render->height);
+            dist_drop(dist, w);
+            return;
+        }
+        w->threads = msg.unit;
+        w->hello = true;
+        return;
+    }
+
+    const uint32_t i = dist_find(w, &msg);
+    if (msg.type != DIST_RESULT || i == w->queued) {
+        dist_drop(dist, w);
+        return;
+    }
+
+    /* geometry is taken from the issued unit, never from the wire */
+    msg = w->queue[i];
+    const uint32_t width = msg.x1 - msg.x0, height = msg.y1 - msg.y0;
+    const size_t count = (size_t)width * height * 3;
+    float tile[DIST_TILE_SIZE * DIST_TILE_SIZE * 3];
+    if (!dist_recv(w->fd, tile, sizeof(float) * count)) {
+        dist_drop(dist, w);
+        return;
+    }
+
+    memmove(w->queue + i, w->queue + i + 1, (--w->queued - i) * sizeof(DistMessage));
+    ++w->units;
+    w->samples += (uint64_t)width * height * msg.spp;
+
+    DistUnit* unit = dist_current(dist, &msg) ? dist->units + msg.unit : NULL;
+    if (unit) {
+        --unit->copies;
+    }
+
+    if (!unit || unit->done) {
+        ++dist->dropped;
+        return;
+    }
+
+    const Render3D* render = dist->render;
+    const size_t stride = (size_t)width * 3;
+    float* dst = dist->result + ((size_t)unit->pass * render->height * render->width + (size_t)msg.y0 * render->width + msg.x0) * 3;
+    for (uint32_t y = 0; y < height; ++y) {
+        memcpy(dst + (size_t)y * render->width * 3, tile + y * stride, sizeof(float) * stride);
+    }
+
+    unit->done = true;
+    --dist->remaining;
+}
+
+static void dist_resolve(const Render3D* render, const float* result, const uint32_t passes, uint8_t* buffer)
+{
+    const size_t pixels = (size_t)render->width * render->height;
+    const float invSpp = 1.0f / (float)render->spp;
+
+    for (size_t i = 0; i < pixels; ++i) {
+        float col[3] = {0.0f, 0.0f, 0.0f};
+        for (uint32_t p = 0; p < passes; ++p) {
+            const float* src = result + (p * pixels + i) * 3;
+            col[0] += src[0];
+            col[1] += src[1];
+            col[2] += src[2];
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            const float v = sqrtf(col[c] * invSpp);
+            buffer[i * 4 + c] = (uint8_t)((v < 1.0f ? v : 1.0f) * 255.0f);
+        }
+        buffer[i * 4 + 3] = 255;
+    }
+}
+
+static void dist_report(const Dist* dist)
+{
+    fprintf(stdout, "worker\tthreads\tunits\tsamples\t\ttime\tMsamples/s\n");
+    const double now = time_clock();
+    for (uint32_t i = 0; i < dist->worker_count; ++i) {
+        const DistWorker* w = dist->workers + i;
+        const double time = (w->alive ? now : w->left) - w->joined;
+        fprintf(stdout, "%u\t%u\t%u\t%llu\t%.03fs\t%.03f%s\n", i + 1, w->threads, w->units, (unsigned long long)w->samples,
+                time, time > 0.0 ? (double)w->samples / time * 1e-6 : 0.0, w->alive ? "" : "\t(lost)");
+    }
+    fprintf(stdout, "duplicate units dropped: %llu\n", (unsigned long long)dist->dropped);
+}
+
+int dist3D_coordinate(const Render3D* render, Scene3D** scenes, const size_t scene_count, const char* address, const char* const* paths, const uint32_t passes, const uint32_t local, Update3D update)
+{
+    const int server = dist_socket(address, true);
+    if (server < 0) {
+        return tracy_error("Could not listen on '%s'.\n", address);
+    }
+
+    uint32_t children = 0;
+    fflush(stdout);
+    for (uint32_t i = 0; i < local; ++i) {
+        const pid_t pid = fork();
+        if (!pid) {
+            close(server);
+            _exit(dist3D_work(render, scenes, scene_count, address, update));
+        }
+        children += pid > 0;
+    }
+
+    const uint32_t size = DIST_TILE_SIZE;
+    const uint32_t tiles_x = (render->width + size - 1) / size;
+    const uint32_t tiles = tiles_x * ((render->height + size - 1) / size);
+    const uint32_t pass_count = passes < render->spp ? passes : render->spp;
+
+    Dist dist;
+    memset(&dist, 0, sizeof(dist));
+    dist.render = render;
+    dist.unit_count = tiles * pass_count;
+    dist.units = malloc(sizeof(DistUnit) * dist.unit_count);
+    dist.retry = malloc(sizeof(uint32_t) * dist.unit_count * DIST_COPIES);
+    dist.result = malloc(sizeof(float) * render->width * render->height * 3 * pass_count);
+    dist.fds = malloc(sizeof(struct pollfd));
+    uint8_t* buffer = malloc((size_t)render->width * render->height * 4);
+
+    int status = EXIT_SUCCESS;
+    bool waiting = false;
+    for (size_t s = 0; s < scene_count && !status; ++s) {
+        for (uint32_t f = 0; f < render->frames && !status; ++f) {
+
+            for (uint32_t p = 0; p < pass_count; ++p) {
+                for (uint32_t t = 0; t < tiles; ++t) {
+                    DistUnit* unit = dist.units + p * tiles + t;
+                    unit->x0 = (t % tiles_x) * size;
+                    unit->y0 = (t / tiles_x) * size;
+                    unit->x1 = unit->x0 + size < render->width ? unit->x0 + size : render->width;
+                    unit->y1 = unit->y0 + size < render->height ? unit->y0 + size : render->height;
+                    unit->pass = p;
+                    unit->spp = render->spp / pass_count + (p < render->spp % pass_count);
+                    unit->copies = 0;
+                    unit->issued = 0.0;
+                    unit->done = false;
+                }
+            }
+
+            dist.scene = (uint32_t)s;
+            dist.frame = f;
+            dist.cursor = 0;
+            dist.retry_count = 0;
+            dist.remaining = dist.unit_count;
+
+            while (dist.remaining) {
+                dist_issue(&dist);
+
+                if (!dist.alive && local) {
+                    while (children && waitpid(-1, NULL, WNOHANG) > 0) {
+                        --children;
+                    }
+                    if (!children) {
+                        status = tracy_error("All local workers exited.\n");
+                        break;
+                    }
+                }
+                else if (!dist.alive && !waiting) {
+                    fprintf(stdout, "waiting for workers on '%s'...\n", address);
+                    fflush(stdout);
+                }
+                waiting = !dist.alive;
+
+                struct pollfd* fds = dist.fds;
+                fds[0] = (struct pollfd){server, POLLIN, 0};
+                for (uint32_t i = 0; i < dist.worker_count; ++i) {
+                    fds[i + 1] = (struct pollfd){dist.workers[i].alive ? dist.workers[i].fd : -1, POLLIN, 0};
+                }
+
+                const uint32_t count = dist.worker_count;
+                if (poll(fds, count + 1, 1000) <= 0) {
+                    continue;
+                }
+
+                for (uint32_t i = 0; i < count; ++i) {
+                    if (fds[i + 1].revents && dist.workers[i].alive) {
+                        dist_receive(&dist, dist.workers + i);
+                    }
+                }
+
+                if (fds[0].revents & POLLIN) {
+                    dist_accept(&dist, server);
+                }
+            }
+
+            if (!status) {
+                dist_resolve(render, dist.result, pass_count, buffer);
+                status = image_write(paths[s * render->frames + f], buffer, render->width, render->height);
+            }
+        }
+    }
+
+    const DistMessage done = {DIST_MAGIC, DIST_DONE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (uint32_t i = 0; i < dist.worker_count; ++i) {
+        if (dist.workers[i].alive) {
+            dist_send(dist.workers[i].fd, &done, sizeof(done));
+        }
+    }
+
+    dist_report(&dist);
+
+    /* drain copies still in flight so workers see a clean shutdown */
+    for (uint32_t i = 0; i < dist.worker_count; ++i) {
+        if (dist.workers[i].alive) {
+            float drain[1024];
+            while (recv(dist.workers[i].fd, drain, sizeof(drain), 0) > 0);
+            close(dist.workers[i].fd);
+        }
+    }
+
+    while (children && waitpid(-1, NULL, 0) > 0) {
+        --children;
+    }
+
+    close(server);
+    if (!strncmp(address, "unix:", 5) || strchr(address, '/')) {
+        unlink(!strncmp(address, "unix:", 5) ? address + 5 : address);
+    }
+
+    free(dist.workers);
+    free(dist.fds);
+    free(dist.units);
+    free(dist.retry);
+    free(dist.result);
+    free(buffer);
+    return status;
+}
@@ -0,0 +1,47 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* empty files map to an empty buffer, mmap does not take a zero length */
+static char file_empty[1];
+
+void* file_map(const char* filename, size_t* size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    if (!st.st_size) {
+        close(fd);
+        *size = 0;
+        return file_empty;
+    }
+
+    /* private writable mapping, pages are only copied if written to */
+    void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return data;
+}
+
+void file_unmap(void* data, const size_t size)
+{
+    if (data && size) {
+        munmap(data, size);
+    }
+}
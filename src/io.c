@@ -23,17 +23,47 @@ int tracy_version(void)
 int tracy_help(const int runtime)
 {
     fprintf(stdout, "tracy usage options:\n");
-    fprintf(stdout, "<file_path>\t:Load scene file to render.\n");
+    fprintf(stdout, "<file_path>\t:Load scene file to render (*.scx, *.scb).\n");
     fprintf(stdout, "-o <file_path>\t:Set name of output file (*.png, *.jpg, *.ppm).\n");
+    if (!runtime) {
+        fprintf(stdout, "\t\t Streams frames to *.y4m or raw *.rgb files, or as Y4M to stdout with '-'.\n");
+    }
     fprintf(stdout, "-w <number>\t:Set the width in pixels of output image.\n");
     fprintf(stdout, "-h <number>\t:Set the height in pixels of output image.\n");
-    fprintf(stdout, "-j <number>\t:Set the number of threads to use.\n");
+    fprintf(stdout, "-j <number>\t:Set the number of threads to use, or 'auto' for every available core.\n");
+    fprintf(stdout, "-pin\t\t:Pin each render thread to its own core, filling one numa node after another.\n");
     fprintf(stdout, "-spp <number>\t:Set the number of samples per pixel to calculate.\n");
     if (!runtime) {
         fprintf(stdout, "-f <number>\t:Set the number of frames to output.\n");
+        fprintf(stdout, "-denoise\t:Filter frames with an edge aware denoiser guided by normal, albedo and depth.\n");
+        fprintf(stdout, "-aov <list>\t:Write comma separated aovs as *.pfm next to each image, or 'all':\n");
+        fprintf(stdout, "\t\t color, depth, normal, albedo, material, object, direct, indirect.\n");
+        fprintf(stdout, "-numa\t\t:Experimental. Pin threads and give every numa node its own copy of static scenes.\n");
+        fprintf(stdout, "-heatmap <cost>\t:Render the cost of each pixel as false color instead of the image:\n");
+        fprintf(stdout, "\t\t nodes, tests, shadow or time, per sample on a log scale.\n");
         fprintf(stdout, "-open\t\t:Open first rendered image after done.\n");
-        fprintf(stdout, "-to-mp4\t\t:Join multiple frames into a video.\n");
+        fprintf(stdout, "-to-mp4\t\t:Stream frames into ffmpeg to encode an mp4 video.\n");
         fprintf(stdout, "-fps <number>\t:Set framerate of output video.\n");
+        fprintf(stdout, "-batch <number>\t:Render all scenes and frames on one tile pool with up to <number> frames in flight.\n");
+        fprintf(stdout, "-coordinator <address>\t:Distribute tiles to worker processes on <host:port> or unix:<path>.\n");
+        fprintf(stdout, "-worker <address>\t:Render tiles for the coordinator at <address>.\n");
+        fprintf(stdout, "-workers <number>\t:Fork <number> local worker processes for distributed rendering.\n");
+        fprintf(stdout, "-passes <number>\t:Split samples per pixel into <number> distributed sample ranges.\n");
+        fprintf(stdout, "-serve <path>\t:Keep scenes loaded and serve render jobs on a unix socket.\n");
+        fprintf(stdout, "-jobs <number>\t:Set the number of server jobs rendered at the same time.\n");
+        fprintf(stdout, "-queue <number>\t:Set the number of server jobs that can wait for a slot.\n");
+        fprintf(stdout, "-stats <format>\t:Report rays, traversal tests and thread times as 'text' or 'json' lines.\n");
+        fprintf(stdout, "-trace <file_path>\t:Record a timeline of every thread and write it as chrome trace json.\n");
+        fprintf(stdout, "-compact\t:Traverse models through packed octrees with 8 bit child bounds.\n");
+        fprintf(stdout, "-accel-report\t:Print octree depth, occupancy, sah cost and memory of every model and scene.\n");
+        fprintf(stdout, "-convert\t:Convert scenes to the format of the output file (*.scx, *.scb).\n");
+    }
+    else {
+        fprintf(stdout, "-lazy\t\t:Build model octrees on demand for a faster first frame.\n");
+        fprintf(stdout, "-compact\t:Traverse models through packed octrees with 8 bit child bounds.\n");
+        fprintf(stdout, "-target-ms <number>\t:Scale resolution and samples per pixel to hit a frame time.\n");
+        fprintf(stdout, "-trace <file_path>\t:Record a timeline of every thread and write it as chrome trace json.\n");
+        fprintf(stdout, "-heatmap <cost>\t:Start with a heatmap of nodes, tests, shadow or time. H cycles through them.\n");
     }
     fprintf(stdout, "-help\t\t:Print tracy's usage information.\n");
     fprintf(stdout, "-v, -version\t:Print tracy's version information.\n");
@@ -44,10 +74,6 @@ int tracy_log_render3D(const Render3D* render)
 {
     fprintf(stdout, "tracy's render information:\n");
     fprintf(stdout, "threads:\t%d\nframes:\t\t%d\nwidth:\t\t%d\nheight:\t\t%d\nsamples:\t%d\n", render->threads, render->frames, render->width, render->height, render->spp);
-#ifdef TRACY_PERF
-    fprintf(stdout, "rendering the scene...\n%s", string_separator);
-    fprintf(stdout, "frames\tNº\t%%\t(px\t/ of\t)\telapsed\t\testimate\tremaining\n%s", string_separator);
-#endif
     return EXIT_SUCCESS;
 }
 
@@ -59,3 +85,109 @@ int tracy_log_time(const float time)
     fprintf(stdout, "%s", string_separator);
     return EXIT_SUCCESS;
 }
+
+/*
+ * counters of every thread since the last stats3D_reset, which was span
+ * seconds ago, so rays per second are the rate of that span. The eta
+ * assumes the remaining frames cost as much as the average frame so far.
+ */
+
+int tracy_log_stats(FILE* file, const int format, const uint32_t frame, const uint32_t frames, const double elapsed, const double span)
+{
+    Stats3D threads[128], total;
+    uint32_t count = stats3D_read(threads, 128, &total);
+    count = count < 128 ? count : 128;
+
+    const double eta = frame && frame < frames ? elapsed / frame * (frames - frame) : 0.0;
+    const double scale = span > 0.0 ? 1.0e-6 / span : 0.0;
+    const uint64_t rays = total.primary_rays + total.secondary_rays + total.shadow_rays;
+
+    if (format == TRACY_STATS_JSON) {
+        fprintf(file, "{\"frame\":%u,\"frames\":%u,\"elapsed\":%.6f,\"eta\":%.6f,\"span\":%.6f,", frame, frames, elapsed, eta, span);
+        fprintf(file, "\"rays\":{\"primary\":%llu,\"secondary\":%llu,\"shadow\":%llu},",
+            (unsigned long long)total.primary_rays, (unsigned long long)total.secondary_rays, (unsigned long long)total.shadow_rays);
+        fprintf(file, "\"mrays\":{\"total\":%.3f,\"primary\":%.3f,\"secondary\":%.3f,\"shadow\":%.3f},",
+            rays * scale, total.primary_rays * scale, total.secondary_rays * scale, total.shadow_rays * scale);
+        fprintf(file, "\"node_visits\":%llu,\"triangle_tests\":%llu,\"sphere_tests\":%llu,\"paths\":[",
+            (unsigned long long)total.node_visits, (unsigned long long)total.triangle_tests, (unsigned long long)total.sphere_tests);
+        for (uint32_t i = 0; i <= TRACY_MAX_DEPTH; ++i) {
+            fprintf(file, "%s%llu", i ? "," : "", (unsigned long long)total.paths[i]);
+        }
+        fprintf(file, "],\"threads\":[");
+        for (uint32_t i = 0; i < count; ++i) {
+            const Stats3D* s = threads + i;
+            fprintf(file, "%s{\"busy\":%.6f,\"rays\":%llu}", i ? "," : "", s->busy,
+                (unsigned long long)(s->primary_rays + s->secondary_rays + s->shadow_rays));
+        }
+        fprintf(file, "]}\n");
+        fflush(file);
+        return EXIT_SUCCESS;
+    }
+
+    fprintf(file, "%s", string_separator);
+    fprintf(file, "frames:\t\t%u / %u\telapsed %.03fs\teta %.03fs\n", frame, frames, elapsed, eta);
+    fprintf(file, "rays:\t\t%llu primary\t%llu secondary\t%llu shadow\n",
+        (unsigned long long)total.primary_rays, (unsigned long long)total.secondary_rays, (unsigned long long)total.shadow_rays);
+    fprintf(file, "Mrays/s:\t%.3f total\t%.3f primary\t%.3f secondary\t%.3f shadow\n",
+        rays * scale, total.primary_rays * scale, total.secondary_rays * scale, total.shadow_rays * scale);
+    fprintf(file, "tests:\t\t%llu nodes\t%llu triangles\t%llu spheres\n",
+        (unsigned long long)total.node_visits, (unsigned long long)total.triangle_tests, (unsigned long long)total.sphere_tests);
+    fprintf(file, "paths:\t");
+    for (uint32_t i = 0; i <= TRACY_MAX_DEPTH; ++i) {
+        fprintf(file, "\t%llu", (unsigned long long)total.paths[i]);
+    }
+    fprintf(file, "\nthread\tbusy\t\trays\n");
+    for (uint32_t i = 0; i < count; ++i) {
+        const Stats3D* s = threads + i;
+        fprintf(file, "%u\t%.03fs\t\t%llu\n", i, s->busy, (unsigned long long)(s->primary_rays + s->secondary_rays + s->shadow_rays));
+    }
+    fprintf(file, "%s", string_separator);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * octree report of a model or a whole scene. The sah cost is the surface
+ * area weighted count of node and triangle tests of oct3D_cost, summed over
+ * models, and duplication is stored triangle copies per mesh triangle.
+ */
+
+int tracy_log_accel(FILE* file, const char* name, const OctReport3D* report)
+{
+    static const char* buckets[TRACY_REPORT_BUCKETS] = {"0", "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65+"};
+    const uint64_t interior = report->nodes - report->leaves;
+    const double mib = 1.0 / (1024.0 * 1024.0);
+
+    fprintf(file, "%s", string_separator);
+    fprintf(file, "accel:\t\t%s\t%u models\t%llu loose triangles\t%llu spheres\n", name, report->models,
+        (unsigned long long)report->loose_triangles, (unsigned long long)report->spheres);
+    fprintf(file, "triangles:\t%llu mesh\t%llu stored\t%.02fx duplication\n", (unsigned long long)report->triangles,
+        (unsigned long long)report->stored, report->triangles ? (double)report->stored / report->triangles : 0.0);
+    fprintf(file, "nodes:\t\t%llu total\t%llu interior\t%llu leaves\t%llu empty\t%llu lazy\tdepth %u\n",
+        (unsigned long long)report->nodes, (unsigned long long)interior, (unsigned long long)report->leaves,
+        (unsigned long long)report->empty, (unsigned long long)report->lazy, report->max_depth);
+    fprintf(file, "per leaf:\t%.02f mean\t%llu max\n",
+        report->leaves ? (double)report->leaf_triangles / report->leaves : 0.0, (unsigned long long)report->max_leaf);
+    fprintf(file, "per interior:\t%.02f mean\t%llu max\t%llu straddling\n",
+        interior ? (double)report->interior_triangles / interior : 0.0, (unsigned long long)report->max_interior,
+        (unsigned long long)report->interior_triangles);
+    fprintf(file, "sah cost:\t%.02f\n", report->cost);
+    fprintf(file, "memory:\t\t%.03f MiB octree\t%.03f MiB mesh\t%.01f bytes per triangle\n", report->octree_bytes * mib,
+        report->mesh_bytes * mib, report->triangles ? (double)report->octree_bytes / report->triangles : 0.0);
+    if (report->pack_bytes) {
+        fprintf(file, "packed:\t\t%.03f MiB\t%llu nodes\t%.01f bytes per triangle\n", report->pack_bytes * mib,
+            (unsigned long long)report->pack_nodes, report->triangles ? (double)report->pack_bytes / report->triangles : 0.0);
+    }
+
+    fprintf(file, "depth\tnodes\ttriangles\n");
+    for (uint32_t i = 0; i < TRACY_REPORT_DEPTH && i <= report->max_depth; ++i) {
+        fprintf(file, "%u%s\t%llu\t%llu\n", i, i + 1 == TRACY_REPORT_DEPTH ? "+" : "",
+            (unsigned long long)report->depth_nodes[i], (unsigned long long)report->depth_triangles[i]);
+    }
+
+    fprintf(file, "leaf size\tleaves\n");
+    for (uint32_t i = 0; i < TRACY_REPORT_BUCKETS; ++i) {
+        fprintf(file, "%s\t\t%llu\n", buckets[i], (unsigned long long)report->leaf_sizes[i]);
+    }
+    fprintf(file, "%s", string_separator);
+    return EXIT_SUCCESS;
+}
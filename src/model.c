@@ -1,26 +1,59 @@
 #include <tracy.h>
 #include <stdlib.h>
+#include <string.h>
 
 static struct vector tri3D_mesh_load(const char* path)
 {
+    const double start = timeline3D_begin();
     Mesh3D mesh = mesh3D_load(path);
     struct vector arr = vector_move(&mesh.vertices);
     mesh3D_free(&mesh);
     vector_restructure(&arr, sizeof(Tri3D));
+    timeline3D_end("model parse", start, -1, -1);
     return arr;
 }
 
-Model3D* model3D_load(const char* filename)
+Model3D* model3D_new(const struct vector triangles)
+{
+    Model3D* model = malloc(sizeof(Model3D));
+    model->triangles = triangles;
+    model->rest = vector_create(sizeof(Tri3D));
+    model->octree = oct3D_create(box3D_from_mesh(triangles.data, triangles.size * 3));
+    model->cost = 0.0;
+    model->anim.move = vec3_uni(0.0);
+    model->anim.axis = vec3_new(0.0, 1.0, 0.0);
+    model->anim.angle = 0.0;
+    model->frame = 0;
+    model->lazy = 0;
+    model->compact = false;
+    memset(&model->pack, 0, sizeof(OctPack3D));
+    return model;
+}
+
+Model3D* model3D_create(const struct vector triangles)
+{
+    Model3D* model = model3D_new(triangles);
+    model3D_rebuild(model);
+    return model;
+}
+
+Model3D* model3D_open(const char* filename)
 {
     struct vector mesh = tri3D_mesh_load(filename);
     if (!mesh.size) {
+        vector_free(&mesh);
         return NULL;
     }
 
-    Model3D* model = malloc(sizeof(Model3D));
-    model->triangles = mesh;
-    model->octree = oct3D_from_mesh(mesh.data, mesh.size);
+    return model3D_new(mesh);
+}
 
+Model3D* model3D_load(const char* filename)
+{
+    Model3D* model = model3D_open(filename);
+    if (model) {
+        model3D_rebuild(model);
+    }
     return model;
 }
 
@@ -50,10 +83,122 @@ void model3D_scale3D(const Model3D* model, const vec3 scale)
     }
 }
 
+static void model3D_repack(Model3D* model)
+{
+    oct3D_pack_free(&model->pack);
+    if (model->compact) {
+        model->pack = oct3D_pack(&model->octree);
+    }
+}
+
+/*
+ * animated models are built in full even when loaded lazily. Refit compares
+ * the cost of the tree against the cost it was built with, which for a lazy
+ * tree is that of its unsplit leaves, and every rebuild would throw away
+ * what traversal has split.
+ */
+static bool model3D_lazy(const Model3D* model)
+{
+    return model->lazy && !model3D_animated(model);
+}
+
+void model3D_rebuild(Model3D* model)
+{
+    const double start = timeline3D_begin();
+    oct3D_free(&model->octree);
+    if (model3D_lazy(model)) {
+        model->octree = oct3D_from_mesh_lazy(model->triangles.data, model->triangles.size, model->lazy);
+    }
+    else model->octree = oct3D_from_mesh(model->triangles.data, model->triangles.size);
+    model->cost = oct3D_cost(&model->octree);
+    model3D_repack(model);
+    timeline3D_end("octree build", start, -1, -1);
+}
+
+/* lazy octrees are left to be split by traversal, they are never packed */
+void model3D_compact(Model3D* model)
+{
+    model->compact = !model3D_lazy(model);
+    model3D_repack(model);
+}
+
+void model3D_report(const Model3D* model, OctReport3D* report)
+{
+    ++report->models;
+    report->triangles += model->triangles.size;
+    report->mesh_bytes += sizeof(Model3D) + (model->triangles.capacity + model->rest.capacity) * sizeof(Tri3D);
+    oct3D_report(&model->octree, report);
+    oct3D_pack_report(&model->pack, report);
+}
+
+void model3D_refit(Model3D* model, const uint32_t threads)
+{
+    oct3D_refit(&model->octree, model->triangles.data, threads);
+    
+    /* refitted boxes grow loose as geometry moves across octants */
+    if (oct3D_cost(&model->octree) > model->cost * TRACY_REFIT_LIMIT) {
+        model3D_rebuild(model);
+    }
+    else model3D_repack(model);
+}
+
+void model3D_deform(Model3D* model, const Tri3D* triangles, const uint32_t threads)
+{
+    memcpy(model->triangles.data, triangles, model->triangles.size * sizeof(Tri3D));
+    model3D_refit(model, threads);
+}
+
+bool model3D_animated(const Model3D* model)
+{
+    return model->anim.angle != 0.0 || model->anim.move.x != 0.0 || 
+        model->anim.move.y != 0.0 || model->anim.move.z != 0.0;
+}
+
+static inline vec3 vec3_rotate(const vec3 v, const vec3 axis, const float c, const float s)
+{
+    /* rodrigues' rotation formula */
+    const vec3 k = _vec3_mult(_vec3_cross(axis, v), s);
+    const vec3 p = _vec3_mult(axis, _vec3_dot(axis, v) * (1.0F - c));
+    return _vec3_add(_vec3_add(_vec3_mult(v, c), k), p);
+}
+
+void model3D_animate(Model3D* model, const uint32_t threads)
+{
+    if (!model3D_animated(model)) {
+        return;
+    }
+
+    const size_t count = model->triangles.size;
+    if (!model->rest.size) {
+        for (size_t i = 0; i < count; ++i) {
+            vector_push(&model->rest, (Tri3D*)model->triangles.data + i);
+        }
+    }
+
+    const float t = (float)++model->frame;
+    const float c = cosf(model->anim.angle * t), s = sinf(model->anim.angle * t);
+    const vec3 axis = vec3_normal(model->anim.axis);
+    const vec3 move = _vec3_mult(model->anim.move, t);
+
+    const vec3* src = model->rest.data;
+    const Box3D box = box3D_from_mesh(src, count * 3);
+    const vec3 center = vec3_mult(_vec3_add(box.min, box.max), 0.5);
+    
+    vec3* dst = model->triangles.data;
+    for (size_t i = 0; i < count * 3; ++i) {
+        const vec3 v = vec3_rotate(_vec3_sub(src[i], center), axis, c, s);
+        dst[i] = _vec3_add(_vec3_add(v, center), move);
+    }
+
+    model3D_refit(model, threads);
+}
+
 void model3D_free(Model3D* model)
 {
     if (!model) return;
     vector_free(&model->triangles);
+    vector_free(&model->rest);
     oct3D_free(&model->octree);
+    oct3D_pack_free(&model->pack);
     free(model);
 }
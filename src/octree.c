@@ -1,7 +1,18 @@
+#define _POSIX_C_SOURCE 200809L
 #include <tracy.h>
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <pthread.h>
+#include <sched.h>
 
-static void oct3D_insert(Oct3D* oct, const Tri3D* triangle);
+#define OCT3D_BUILT 0
+#define OCT3D_LAZY 1
+#define OCT3D_SPLITTING 2
+
+#define OCT3D_PACK_LINE 64
+#define OCT3D_PACK_LEAF 15 /* most triangles a leaf child count holds */
+#define OCT3D_PACK_OWN ((1u << 24) - 1)
 
 static Oct3D* oct3D_children_create(const Box3D* box)
 {
@@ -28,47 +39,90 @@ static Oct3D* oct3D_children_create(const Box3D* box)
     return children;
 }
 
-static bool oct3D_children_insert(Oct3D* oct, const Tri3D* triangle)
+/* index + 1 of the only child overlapping the triangle, 0 if it straddles */
+static size_t oct3D_children_find(const Oct3D* oct, const Tri3D* triangle)
 {
     const Box3D b = box3D_from_triangle(triangle);
     size_t hitIndex = 0, i;
     for (i = 0; i < 8; ++i) {
         if (box3D_overlap(oct->children[i].box, b)) {
             if (hitIndex) {
-                hitIndex = 0;
-                break;
+                return 0;
             }
             hitIndex = i + 1;
         }
     }
 
-    if (hitIndex) {
-        oct3D_insert(oct->children + hitIndex - 1, triangle);
+    return hitIndex;
+}
+
+/*
+ * splits a node holding more than TRACY_OCTREE_LIMIT triangles, moving every
+ * triangle that fits in a single octant down to that child. Straddling
+ * triangles stay in the node. Children are split recursively for the given
+ * number of levels and left lazy below that.
+ */
+
+static void oct3D_split(Oct3D* oct, const uint32_t levels)
+{
+    if (oct->triangles.size <= TRACY_OCTREE_LIMIT) {
+        return;
+    }
+
+    oct->children = oct3D_children_create(&oct->box);
+
+    Tri3D* t = oct->triangles.data;
+    uint32_t* indices = oct->indices.data;
+    const size_t count = oct->triangles.size;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const size_t n = oct3D_children_find(oct, t + i);
+        if (n) {
+            vector_push(&oct->children[n - 1].triangles, t + i);
+            vector_push(&oct->children[n - 1].indices, indices + i);
+        }
+        else {
+            t[kept] = t[i];
+            indices[kept++] = indices[i];
+        }
     }
 
-    return !!hitIndex;
+    oct->triangles.size = kept;
+    oct->indices.size = kept;
+
+    for (int i = 0; i < 8; ++i) {
+        Oct3D* child = oct->children + i;
+        if (levels > 1) {
+            oct3D_split(child, levels - 1);
+        }
+        else if (child->triangles.size > TRACY_OCTREE_LIMIT) {
+            child->state = OCT3D_LAZY;
+        }
+    }
 }
 
-static void oct3D_insert(Oct3D* oct, const Tri3D* triangle)
+/* 
+ * lazy nodes are split by the first thread whose ray enters them, the
+ * finished subtree is published with a release store of the node state.
+ * Other threads reaching the node meanwhile wait for the publication.
+ */
+
+static void oct3D_expand(Oct3D* oct)
 {
-    if (oct->triangles.size < TRACY_OCTREE_LIMIT) {
-        vector_push(&oct->triangles, triangle);
+    uint32_t state = __atomic_load_n(&oct->state, __ATOMIC_ACQUIRE);
+    if (state == OCT3D_BUILT) {
         return;
     }
-    
-    if (!oct->children) {
-        oct->children = oct3D_children_create(&oct->box);
-        const Tri3D* t = oct->triangles.data;
-        for (size_t i = 0; i < oct->triangles.size; ++i, ++t) {
-            if (oct3D_children_insert(oct, t)) {
-                vector_remove(&oct->triangles, i);
-                --i, --t;
-            }
-        }
+
+    if (state == OCT3D_LAZY && __atomic_compare_exchange_n(&oct->state, &state, OCT3D_SPLITTING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        oct3D_split(oct, 1);
+        __atomic_store_n(&oct->state, OCT3D_BUILT, __ATOMIC_RELEASE);
+        return;
     }
 
-    if (!oct3D_children_insert(oct, triangle)) {
-        vector_push(&oct->triangles, triangle);
+    while (__atomic_load_n(&oct->state, __ATOMIC_ACQUIRE) != OCT3D_BUILT) {
+        sched_yield();
     }
 }
 
@@ -78,27 +132,245 @@ Oct3D oct3D_create(const Box3D box)
     oct.box = box;
     oct.children = NULL;
     oct.triangles = vector_create(sizeof(Tri3D));
+    oct.indices = vector_create(sizeof(uint32_t));
+    oct.state = OCT3D_BUILT;
     return oct;
 }
 
-Oct3D oct3D_from_mesh(const Tri3D* triangles, const size_t count)
+Oct3D oct3D_from_mesh_lazy(const Tri3D* triangles, const size_t count, const uint32_t levels)
 {
     Oct3D oct = oct3D_create(box3D_from_mesh((vec3*)triangles, count * 3));
     for (size_t i = 0; i < count; ++i) {
-        oct3D_insert(&oct, triangles + i);
+        const uint32_t index = (uint32_t)i;
+        vector_push(&oct.triangles, triangles + i);
+        vector_push(&oct.indices, &index);
     }
+
+    if (levels) {
+        oct3D_split(&oct, levels);
+    }
+    else if (count > TRACY_OCTREE_LIMIT) {
+        oct.state = OCT3D_LAZY;
+    }
+
     return oct;
 }
 
-bool oct3D_hit(const Oct3D* oct, const Ray3D* ray, Hit3D* hit, float closest)
+Oct3D oct3D_from_mesh(const Tri3D* triangles, const size_t count)
+{
+    return oct3D_from_mesh_lazy(triangles, count, UINT32_MAX);
+}
+
+static inline Box3D oct3D_box_merge(const Box3D a, const Box3D b)
+{
+    Box3D box;
+    box.min = _vec3_new(fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y), fminf(a.min.z, b.min.z));
+    box.max = _vec3_new(fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y), fmaxf(a.max.z, b.max.z));
+    return box;
+}
+
+static inline double oct3D_box_area(const Box3D* box)
+{
+    const vec3 d = _vec3_sub(box->max, box->min);
+    return 2.0 * ((double)d.x * d.y + (double)d.y * d.z + (double)d.z * d.x);
+}
+
+/* surface area weighted cost of a subtree, skipping empty nodes */
+static double oct3D_node_cost(const Oct3D* oct, bool* any)
+{
+    double cost = 0.0;
+    bool children = false;
+    if (oct->children) {
+        for (int i = 0; i < 8; ++i) {
+            cost += oct3D_node_cost(oct->children + i, &children);
+        }
+    }
+
+    if (children || oct->triangles.size) {
+        *any = true;
+        cost += oct3D_box_area(&oct->box) * (1.0 + oct->triangles.size);
+    }
+    
+    return cost;
+}
+
+float oct3D_cost(const Oct3D* oct)
+{
+    bool any = false;
+    const double cost = oct3D_node_cost(oct, &any);
+    const double area = oct3D_box_area(&oct->box);
+    return (float)(area > FLT_MIN ? cost / area : 0.0);
+}
+
+/*
+ * structure report: adds the node, depth and leaf size counts and the
+ * memory of a subtree to the report. Node memory is the children arrays
+ * plus the allocated capacity of the per node triangle and index vectors.
+ */
+
+static void oct3D_report_node(const Oct3D* oct, OctReport3D* report, const uint32_t depth)
+{
+    const uint64_t count = oct->triangles.size;
+    const uint32_t row = depth < TRACY_REPORT_DEPTH ? depth : TRACY_REPORT_DEPTH - 1;
+
+    ++report->nodes;
+    report->stored += count;
+    report->depth_nodes[row]++;
+    report->depth_triangles[row] += count;
+    report->max_depth = depth > report->max_depth ? depth : report->max_depth;
+    report->octree_bytes += oct->triangles.capacity * sizeof(Tri3D) + oct->indices.capacity * sizeof(uint32_t);
+    report->lazy += oct->state != OCT3D_BUILT;
+
+    if (!oct->children) {
+        uint32_t bucket = 0;
+        if (count) {
+            for (bucket = 1; bucket + 1 < TRACY_REPORT_BUCKETS && (1ull << (bucket - 1)) < count; ++bucket);
+        }
+
+        ++report->leaves;
+        report->empty += !count;
+        report->leaf_triangles += count;
+        report->leaf_sizes[bucket]++;
+        report->max_leaf = count > report->max_leaf ? count : report->max_leaf;
+        return;
+    }
+
+    report->interior_triangles += count;
+    report->max_interior = count > report->max_interior ? count : report->max_interior;
+    report->octree_bytes += sizeof(Oct3D) * 8;
+    for (int i = 0; i < 8; ++i) {
+        oct3D_report_node(oct->children + i, report, depth + 1);
+    }
+}
+
+void oct3D_report(const Oct3D* oct, OctReport3D* report)
+{
+    report->octree_bytes += sizeof(Oct3D);
+    report->cost += oct3D_cost(oct);
+    oct3D_report_node(oct, report, 0);
+}
+
+/* 
+ * refit updates the triangle copies of every node from the source mesh
+ * and shrinks or grows node boxes bottom-up to fit their contents.
+ * Empty nodes keep their previous box and are never refitted into.
+ */
+
+static bool oct3D_refit_node(Oct3D* oct, const Tri3D* source)
+{
+    Tri3D* t = oct->triangles.data;
+    const uint32_t* indices = oct->indices.data;
+    const size_t count = oct->triangles.size;
+    
+    bool any = false;
+    Box3D box;
+
+    for (size_t i = 0; i < count; ++i) {
+        t[i] = source[indices[i]];
+        const Box3D b = box3D_from_triangle(t + i);
+        box = any ? oct3D_box_merge(box, b) : b;
+        any = true;
+    }
+
+    if (oct->children) {
+        for (int i = 0; i < 8; ++i) {
+            if (oct3D_refit_node(oct->children + i, source)) {
+                box = any ? oct3D_box_merge(box, oct->children[i].box) : oct->children[i].box;
+                any = true;
+            }
+        }
+    }
+
+    if (any) {
+        oct->box = box;
+    }
+
+    return any;
+}
+
+typedef struct RefitInfo {
+    Oct3D* children;
+    const Tri3D* source;
+    uint32_t start;
+    uint32_t step;
+    bool any[8];
+} RefitInfo;
+
+static void* oct3D_refit_job(void* arg)
+{
+    RefitInfo* info = arg;
+    for (uint32_t i = info->start; i < 8; i += info->step) {
+        info->any[i] = oct3D_refit_node(info->children + i, info->source);
+    }
+    return NULL;
+}
+
+void oct3D_refit(Oct3D* oct, const Tri3D* source, const uint32_t threads)
+{
+    if (!oct->children || threads < 2) {
+        oct3D_refit_node(oct, source);
+        return;
+    }
+
+    /* the eight root subtrees are refitted in parallel */
+    const uint32_t thread_count = threads < 8 ? threads : 8;
+    pthread_t workers[thread_count - 1];
+    RefitInfo infos[thread_count];
+    
+    for (uint32_t i = 0; i < thread_count; ++i) {
+        infos[i].children = oct->children;
+        infos[i].source = source;
+        infos[i].start = i;
+        infos[i].step = thread_count;
+        if (i + 1 < thread_count) {
+            pthread_create(&workers[i], NULL, &oct3D_refit_job, &infos[i]);
+        }
+    }
+    
+    oct3D_refit_job(&infos[thread_count - 1]);
+    
+    for (uint32_t i = 0; i + 1 < thread_count; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    bool any = false;
+    Box3D box;
+    
+    Tri3D* t = oct->triangles.data;
+    const uint32_t* indices = oct->indices.data;
+    for (size_t i = 0; i < oct->triangles.size; ++i) {
+        t[i] = source[indices[i]];
+        const Box3D b = box3D_from_triangle(t + i);
+        box = any ? oct3D_box_merge(box, b) : b;
+        any = true;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (infos[i % thread_count].any[i]) {
+            box = any ? oct3D_box_merge(box, oct->children[i].box) : oct->children[i].box;
+            any = true;
+        }
+    }
+
+    if (any) {
+        oct->box = box;
+    }
+}
+
+/* traversal counts are kept on the stack and added to the thread stats once per ray */
+static bool oct3D_hit_node(const Oct3D* oct, const Ray3D* ray, Hit3D* hit, float closest, uint64_t* visits, uint64_t* tests)
 {
     Hit3D tmpHit;
     bool anything = false;
+    ++*visits;
 
     if (box3D_hit_fast(&oct->box, ray, &tmpHit.t) && tmpHit.t > TRACY_MIN_DIST && tmpHit.t < closest) {
         
+        oct3D_expand((Oct3D*)(size_t)oct);
+
         const Tri3D* t = oct->triangles.data;
         const size_t count = oct->triangles.size;
+        *tests += count;
 
         for (size_t i = 0; i < count; i++) {
             if (tri3D_hit_fast(t++, ray, &tmpHit, closest)) {
@@ -110,7 +382,7 @@ bool oct3D_hit(const Oct3D* oct, const Ray3D* ray, Hit3D* hit, float closest)
 
         if (oct->children) {
             for (int i = 0; i < 8; ++i) {
-                if (oct3D_hit(oct->children + i, ray, &tmpHit, closest)) {
+                if (oct3D_hit_node(oct->children + i, ray, &tmpHit, closest, visits, tests)) {
                     closest = tmpHit.t;
                     *hit = tmpHit;
                     anything = true;
@@ -122,6 +394,306 @@ bool oct3D_hit(const Oct3D* oct, const Ray3D* ray, Hit3D* hit, float closest)
     return anything;
 }
 
+bool oct3D_hit(const Oct3D* oct, const Ray3D* ray, Hit3D* hit, float closest)
+{
+    uint64_t visits = 0, tests = 0;
+    const bool anything = oct3D_hit_node(oct, ray, hit, closest, &visits, &tests);
+    Stats3D* stats = stats3D_local();
+    stats->node_visits += visits;
+    stats->triangle_tests += tests;
+    return anything;
+}
+
+/*
+ * packed octree
+ *
+ * A compact copy of a built octree that is only traversed. Each node with
+ * children becomes one 64 byte record holding the bounds of its eight
+ * children, quantized to 8 bits in the frame of its own bounds and rounded
+ * outward, so a node and everything needed to cull its children share one
+ * cache line. Child bounds are the tight bounds of the triangles below
+ * them instead of the octant. Triangles are copied in traversal order: the
+ * straddling ones of a node, then those of its leaf children. Frames are
+ * recomputed from the root box on the way down by the same code at build
+ * and at traversal, so rounding can never cull a triangle.
+ */
+
+struct OctNode3D {
+    uint8_t lo[8][3];
+    uint8_t hi[8][3];
+    uint32_t nodes; /* first node of the children with children, stored in child order */
+    uint32_t triangles; /* own triangles, then those of the leaf children */
+    uint32_t own; /* own triangle count, mask of the children with nodes in the top byte */
+    uint32_t leaves; /* triangle count of every leaf child, 4 bits each */
+};
+
+static inline float oct3D_pack_at(const float min, const float scale, const uint32_t q)
+{
+    return min + (float)q * scale;
+}
+
+/* steps of 1/254 of the padded extent, so step 255 covers the max whatever the rounding */
+static inline vec3 oct3D_pack_scale(const Box3D* frame)
+{
+    const vec3 d = _vec3_sub(frame->max, frame->min);
+    const vec3 pad = _vec3_new(
+        (fabsf(frame->min.x) + fabsf(frame->max.x)) * 1.0e-6f,
+        (fabsf(frame->min.y) + fabsf(frame->max.y)) * 1.0e-6f,
+        (fabsf(frame->min.z) + fabsf(frame->max.z)) * 1.0e-6f
+    );
+    return _vec3_mult(_vec3_add(d, pad), 1.0f / 254.0f);
+}
+
+static inline Box3D oct3D_pack_child(const Box3D* frame, const vec3 scale, const OctNode3D* node, const int i)
+{
+    Box3D box;
+    box.min = _vec3_new(
+        oct3D_pack_at(frame->min.x, scale.x, node->lo[i][0]),
+        oct3D_pack_at(frame->min.y, scale.y, node->lo[i][1]),
+        oct3D_pack_at(frame->min.z, scale.z, node->lo[i][2])
+    );
+    box.max = _vec3_new(
+        oct3D_pack_at(frame->min.x, scale.x, node->hi[i][0]),
+        oct3D_pack_at(frame->min.y, scale.y, node->hi[i][1]),
+        oct3D_pack_at(frame->min.z, scale.z, node->hi[i][2])
+    );
+    return box;
+}
+
+static uint8_t oct3D_pack_floor(const float min, const float scale, const float v)
+{
+    int q = scale > 0.0f ? (int)((v - min) / scale) : 0;
+    q = q < 0 ? 0 : q > 255 ? 255 : q;
+    while (q > 0 && oct3D_pack_at(min, scale, q) > v) {
+        --q;
+    }
+    return (uint8_t)q;
+}
+
+static uint8_t oct3D_pack_ceil(const float min, const float scale, const float v)
+{
+    int q = scale > 0.0f ? (int)ceilf((v - min) / scale) : 0;
+    q = q < 0 ? 0 : q > 255 ? 255 : q;
+    while (q < 255 && oct3D_pack_at(min, scale, q) < v) {
+        ++q;
+    }
+    return (uint8_t)q;
+}
+
+static bool oct3D_pack_bounds(const Oct3D* oct, Box3D* box)
+{
+    bool any = false;
+    const Tri3D* t = oct->triangles.data;
+    for (size_t i = 0; i < oct->triangles.size; ++i) {
+        const Box3D b = box3D_from_triangle(t + i);
+        *box = any ? oct3D_box_merge(*box, b) : b;
+        any = true;
+    }
+
+    if (oct->children) {
+        for (int i = 0; i < 8; ++i) {
+            Box3D b;
+            if (oct3D_pack_bounds(oct->children + i, &b)) {
+                *box = any ? oct3D_box_merge(*box, b) : b;
+                any = true;
+            }
+        }
+    }
+
+    return any;
+}
+
+static void oct3D_pack_push(struct vector* triangles, const Oct3D* oct)
+{
+    const Tri3D* t = oct->triangles.data;
+    for (size_t i = 0; i < oct->triangles.size; ++i) {
+        vector_push(triangles, t + i);
+    }
+}
+
+/* fills the node at index and appends its subtree, false if a count does not fit */
+static bool oct3D_pack_node(const Oct3D* oct, const Box3D* frame, const uint32_t index, struct vector* nodes, struct vector* triangles)
+{
+    if (oct->triangles.size > OCT3D_PACK_OWN) {
+        return false;
+    }
+
+    OctNode3D node;
+    memset(&node, 0, sizeof(OctNode3D));
+    node.triangles = (uint32_t)triangles->size;
+    oct3D_pack_push(triangles, oct);
+
+    const vec3 scale = oct3D_pack_scale(frame);
+    uint32_t inner = 0;
+    for (int i = 0; oct->children && i < 8; ++i) {
+        const Oct3D* child = oct->children + i;
+        Box3D b;
+        if (!oct3D_pack_bounds(child, &b)) {
+            continue;
+        }
+
+        node.lo[i][0] = oct3D_pack_floor(frame->min.x, scale.x, b.min.x);
+        node.lo[i][1] = oct3D_pack_floor(frame->min.y, scale.y, b.min.y);
+        node.lo[i][2] = oct3D_pack_floor(frame->min.z, scale.z, b.min.z);
+        node.hi[i][0] = oct3D_pack_ceil(frame->min.x, scale.x, b.max.x);
+        node.hi[i][1] = oct3D_pack_ceil(frame->min.y, scale.y, b.max.y);
+        node.hi[i][2] = oct3D_pack_ceil(frame->min.z, scale.z, b.max.z);
+
+        if (child->children || child->triangles.size > OCT3D_PACK_LEAF) {
+            inner |= 1u << i;
+        }
+        else {
+            node.leaves |= (uint32_t)child->triangles.size << (i * 4);
+            oct3D_pack_push(triangles, child);
+        }
+    }
+
+    node.own = (uint32_t)oct->triangles.size | inner << 24;
+    node.nodes = (uint32_t)nodes->size;
+    for (int i = 0; i < 8; ++i) {
+        if (inner & (1u << i)) {
+            vector_push(nodes, &node);
+        }
+    }
+    ((OctNode3D*)nodes->data)[index] = node;
+
+    uint32_t next = node.nodes;
+    for (int i = 0; i < 8; ++i) {
+        if (inner & (1u << i)) {
+            const Box3D child = oct3D_pack_child(frame, scale, &node, i);
+            if (!oct3D_pack_node(oct->children + i, &child, next++, nodes, triangles)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* an empty pack, without nodes, means the octree is traversed instead */
+OctPack3D oct3D_pack(const Oct3D* oct)
+{
+    OctPack3D pack = {{{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}}, NULL, NULL, 0, 0};
+    Box3D box;
+    if (!oct3D_pack_bounds(oct, &box)) {
+        return pack;
+    }
+
+    struct vector nodes = vector_create(sizeof(OctNode3D));
+    struct vector triangles = vector_create(sizeof(Tri3D));
+    OctNode3D root;
+    memset(&root, 0, sizeof(OctNode3D));
+    vector_push(&nodes, &root);
+
+    void* memory = NULL;
+    if (oct3D_pack_node(oct, &box, 0, &nodes, &triangles) && nodes.size <= UINT32_MAX &&
+        !posix_memalign(&memory, OCT3D_PACK_LINE, nodes.size * sizeof(OctNode3D))) {
+        memcpy(memory, nodes.data, nodes.size * sizeof(OctNode3D));
+        pack.box = box;
+        pack.nodes = memory;
+        pack.node_count = (uint32_t)nodes.size;
+        pack.triangle_count = (uint32_t)triangles.size;
+        pack.triangles = vector_move(&triangles).data;
+    }
+
+    vector_free(&nodes);
+    vector_free(&triangles);
+    return pack;
+}
+
+typedef struct PackRay3D {
+    const Ray3D* ray;
+    vec3 inv;
+    uint64_t visits;
+    uint64_t tests;
+} PackRay3D;
+
+/* slab test with the inverse direction of the ray, nan slabs of axis parallel rays are ignored */
+static inline bool oct3D_pack_slab(const Box3D* box, const PackRay3D* r, const float closest)
+{
+    const vec3 o = r->ray->orig;
+    const float x0 = (box->min.x - o.x) * r->inv.x, x1 = (box->max.x - o.x) * r->inv.x;
+    const float y0 = (box->min.y - o.y) * r->inv.y, y1 = (box->max.y - o.y) * r->inv.y;
+    const float z0 = (box->min.z - o.z) * r->inv.z, z1 = (box->max.z - o.z) * r->inv.z;
+    const float near = fmaxf(fmaxf(fminf(x0, x1), fminf(y0, y1)), fminf(z0, z1));
+    const float far = fminf(fminf(fmaxf(x0, x1), fmaxf(y0, y1)), fmaxf(z0, z1));
+    return near <= far && far > TRACY_MIN_DIST && near < closest;
+}
+
+static inline bool oct3D_pack_tris(const Tri3D* t, const uint32_t count, PackRay3D* r, Hit3D* hit, float* closest)
+{
+    Hit3D tmpHit;
+    bool anything = false;
+    r->tests += count;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (tri3D_hit_fast(t + i, r->ray, &tmpHit, *closest)) {
+            *closest = tmpHit.t;
+            *hit = tmpHit;
+            anything = true;
+        }
+    }
+    return anything;
+}
+
+static bool oct3D_pack_hit_node(const OctPack3D* pack, const OctNode3D* node, const Box3D* frame, PackRay3D* r, Hit3D* hit, float closest)
+{
+    const uint32_t own = node->own & OCT3D_PACK_OWN, inner = node->own >> 24;
+    bool anything = oct3D_pack_tris(pack->triangles + node->triangles, own, r, hit, &closest);
+
+    const vec3 scale = oct3D_pack_scale(frame);
+    const OctNode3D* child = pack->nodes + node->nodes;
+    uint32_t tri = node->triangles + own;
+    for (int i = 0; i < 8; ++i) {
+        const uint32_t count = (node->leaves >> (i * 4)) & OCT3D_PACK_LEAF;
+        const bool nested = inner & (1u << i);
+        if (!count && !nested) {
+            continue;
+        }
+
+        ++r->visits;
+        const Box3D box = oct3D_pack_child(frame, scale, node, i);
+        if (oct3D_pack_slab(&box, r, closest)) {
+            if (nested ? oct3D_pack_hit_node(pack, child, &box, r, hit, closest) :
+                oct3D_pack_tris(pack->triangles + tri, count, r, hit, &closest)) {
+                closest = hit->t;
+                anything = true;
+            }
+        }
+
+        tri += count;
+        child += nested;
+    }
+
+    return anything;
+}
+
+bool oct3D_pack_hit(const OctPack3D* pack, const Ray3D* ray, Hit3D* hit, float closest)
+{
+    PackRay3D r = {ray, _vec3_new(1.0f / ray->dir.x, 1.0f / ray->dir.y, 1.0f / ray->dir.z), 1, 0};
+    const bool anything = oct3D_pack_slab(&pack->box, &r, closest) &&
+        oct3D_pack_hit_node(pack, pack->nodes, &pack->box, &r, hit, closest);
+    Stats3D* stats = stats3D_local();
+    stats->node_visits += r.visits;
+    stats->triangle_tests += r.tests;
+    return anything;
+}
+
+void oct3D_pack_report(const OctPack3D* pack, OctReport3D* report)
+{
+    report->pack_nodes += pack->node_count;
+    report->pack_bytes += (uint64_t)pack->node_count * sizeof(OctNode3D) + (uint64_t)pack->triangle_count * sizeof(Tri3D);
+}
+
+void oct3D_pack_free(OctPack3D* pack)
+{
+    free(pack->nodes);
+    free(pack->triangles);
+    pack->nodes = NULL;
+    pack->triangles = NULL;
+    pack->node_count = 0;
+    pack->triangle_count = 0;
+}
+
 void oct3D_free(Oct3D* oct)
 {
     if (oct->children) {
@@ -131,4 +703,5 @@ void oct3D_free(Oct3D* oct)
         free(oct->children);
     }
     vector_free(&oct->triangles);
+    vector_free(&oct->indices);
 }
@@ -0,0 +1,402 @@
+#include <tracy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <png.h>
+#include <jpeglib.h>
+
+/*
+ * image writers take the bottom-up RGBA buffer produced by render3D_render
+ * and emit rows top-down, so no flipped copy of the image is ever made.
+ */
+
+static int image_write_png(FILE* file, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        return EXIT_FAILURE;
+    }
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    const size_t stride = (size_t)width * 4;
+    for (uint32_t y = height; y--;) {
+        png_write_row(png, (png_const_bytep)(pixels + y * stride));
+    }
+
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    return EXIT_SUCCESS;
+}
+
+/* libjpeg exits the process on errors unless error_exit jumps back out */
+typedef struct JpegError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} JpegError;
+
+static void image_jpg_error(j_common_ptr cinfo)
+{
+    JpegError* err = (JpegError*)cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->jump, 1);
+}
+
+static int image_write_jpg(FILE* file, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    struct jpeg_compress_struct cinfo;
+    JpegError jerr;
+
+    JSAMPLE* row = malloc(width * 3);
+    JSAMPROW rows[1] = {row};
+    cinfo.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = &image_jpg_error;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(row);
+        return EXIT_FAILURE;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, file);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 95, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    const size_t stride = (size_t)width * 4;
+    for (uint32_t y = height; y--;) {
+        const uint8_t* src = pixels + y * stride;
+        for (uint32_t x = 0; x < width; ++x, src += 4) {
+            row[x * 3 + 0] = src[0];
+            row[x * 3 + 1] = src[1];
+            row[x * 3 + 2] = src[2];
+        }
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    return EXIT_SUCCESS;
+}
+
+static int image_write_rgb(FILE* file, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    const size_t stride = (size_t)width * 4;
+    uint8_t* row = malloc(width * 3);
+    for (uint32_t y = height; y--;) {
+        const uint8_t* src = pixels + y * stride;
+        for (uint32_t x = 0; x < width; ++x, src += 4) {
+            row[x * 3 + 0] = src[0];
+            row[x * 3 + 1] = src[1];
+            row[x * 3 + 2] = src[2];
+        }
+        if (fwrite(row, width * 3, 1, file) != 1) {
+            break;
+        }
+    }
+
+    free(row);
+    return ferror(file) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int image_write_ppm(FILE* file, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    return image_write_rgb(file, pixels, width, height);
+}
+
+/* encoders stream straight into the file, so encode and write are one span */
+static int image_write_file(const char* path, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    int (*write)(FILE*, const uint8_t*, const uint32_t, const uint32_t) = NULL;
+
+    const char* dot = strrchr(path, '.');
+    if (dot && (!strcmp(dot, ".png") || !strcmp(dot, ".PNG"))) {
+        write = &image_write_png;
+    }
+    else if (dot && (!strcmp(dot, ".jpg") || !strcmp(dot, ".jpeg") || !strcmp(dot, ".JPG"))) {
+        write = &image_write_jpg;
+    }
+    else if (dot && (!strcmp(dot, ".ppm") || !strcmp(dot, ".PPM"))) {
+        write = &image_write_ppm;
+    }
+    else {
+        /* formats without a streaming writer go through imgtool */
+        bmp_t bmp = {width, height, 4, (uint8_t*)(size_t)pixels};
+        bmp = bmp_flip_vertical(&bmp);
+        bmp_write(path, &bmp);
+        bmp_free(&bmp);
+        return EXIT_SUCCESS;
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return tracy_error("Could not write file '%s'.\n", path);
+    }
+
+    const int ret = write(file, pixels, width, height);
+    fclose(file);
+    return ret;
+}
+
+int image_write(const char* path, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    const double start = timeline3D_begin();
+    const int ret = image_write_file(path, pixels, width, height);
+    timeline3D_end("image write", start, -1, -1);
+    return ret;
+}
+
+/* 
+ * portable float maps store rows bottom-up like the render buffers, so aov
+ * planes are written as they are. A negative scale marks little endian.
+ */
+
+int image_write_pfm(const char* path, const float* data, const uint32_t width, const uint32_t height, const uint32_t channels)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return tracy_error("Could not write file '%s'.\n", path);
+    }
+
+    const uint16_t probe = 1;
+    const bool little = *(const uint8_t*)&probe;
+    fprintf(file, "%s\n%u %u\n%s\n", channels == 1 ? "Pf" : "PF", width, height, little ? "-1.0" : "1.0");
+
+    const size_t count = (size_t)width * height * channels;
+    const bool ok = fwrite(data, sizeof(float), count, file) == count;
+    fclose(file);
+
+    if (!ok) {
+        return tracy_error("Failed writing file '%s'.\n", path);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * stream writers append frames to an open file or pipe. Y4M frames are
+ * converted to 4:4:4 BT.601 studio range YCbCr, raw frames are packed RGB.
+ */
+
+static int stream_write_y4m(FILE* file, const uint8_t* pixels, const uint32_t width, const uint32_t height)
+{
+    const size_t stride = (size_t)width * 4;
+    const size_t plane = (size_t)width * height;
+    uint8_t* yuv = malloc(plane * 3);
+    uint8_t* Y = yuv, *U = yuv + plane, *V = yuv + plane * 2;
+
+    for (uint32_t y = height; y--;) {
+        const uint8_t* src = pixels + y * stride;
+        for (uint32_t x = 0; x < width; ++x, src += 4) {
+            const int r = src[0], g = src[1], b = src[2];
+            *Y++ = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            *U++ = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            *V++ = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    const bool ok = fputs("FRAME\n", file) >= 0 && fwrite(yuv, plane * 3, 1, file) == 1;
+    free(yuv);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * asynchronous output stage: the renderer acquires a free framebuffer,
+ * renders into it and submits it with its destination. Encoder threads
+ * write submitted frames and return their buffers to the free list, so
+ * at most buffer_count frames are in flight at any time. Stream outputs
+ * use a single encoder so frames reach the stream in submission order.
+ */
+
+typedef struct OutputJob {
+    uint8_t* pixels;
+    char* path;
+} OutputJob;
+
+struct Output3D {
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;
+    pthread_cond_t released;
+    pthread_t* encoders;
+    uint8_t** pool;
+    uint8_t** buffers;
+    OutputJob* queue;
+    FILE* stream;
+    int (*stream_write)(FILE*, const uint8_t*, const uint32_t, const uint32_t);
+    uint32_t encoder_count;
+    uint32_t buffer_count;
+    uint32_t free_count;
+    uint32_t head;
+    uint32_t queued;
+    uint32_t width;
+    uint32_t height;
+    bool done;
+    int status;
+};
+
+static void* output3D_encode(void* arg)
+{
+    Output3D* out = arg;
+
+    pthread_mutex_lock(&out->lock);
+    while (true) {
+        while (!out->queued && !out->done) {
+            pthread_cond_wait(&out->submitted, &out->lock);
+        }
+
+        if (!out->queued) {
+            break;
+        }
+
+        const OutputJob job = out->queue[out->head];
+        out->head = (out->head + 1) % out->buffer_count;
+        --out->queued;
+        pthread_mutex_unlock(&out->lock);
+
+        int status;
+        if (out->stream) {
+            const double start = timeline3D_begin();
+            status = out->stream_write(out->stream, job.pixels, out->width, out->height);
+            timeline3D_end("stream write", start, -1, -1);
+        }
+        else {
+            status = image_write(job.path, job.pixels, out->width, out->height);
+            free(job.path);
+        }
+
+        pthread_mutex_lock(&out->lock);
+        out->status |= status;
+        out->buffers[out->free_count++] = job.pixels;
+        pthread_cond_broadcast(&out->released);
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    return NULL;
+}
+
+Output3D* output3D_create(const uint32_t width, const uint32_t height, const uint32_t buffers, const uint32_t encoders)
+{
+    Output3D* out = malloc(sizeof(Output3D));
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->submitted, NULL);
+    pthread_cond_init(&out->released, NULL);
+
+    out->width = width;
+    out->height = height;
+    out->buffer_count = buffers ? buffers : 1;
+    out->free_count = out->buffer_count;
+    out->encoder_count = encoders ? encoders : 1;
+    out->head = 0;
+    out->queued = 0;
+    out->done = false;
+    out->status = EXIT_SUCCESS;
+    out->stream = NULL;
+    out->stream_write = NULL;
+
+    out->queue = malloc(sizeof(OutputJob) * out->buffer_count);
+    out->pool = malloc(sizeof(uint8_t*) * out->buffer_count);
+    out->buffers = malloc(sizeof(uint8_t*) * out->buffer_count);
+    for (uint32_t i = 0; i < out->buffer_count; ++i) {
+        out->pool[i] = calloc((size_t)width * height * 4, sizeof(uint8_t));
+        out->buffers[i] = out->pool[i];
+    }
+
+    out->encoders = malloc(sizeof(pthread_t) * out->encoder_count);
+    for (uint32_t i = 0; i < out->encoder_count; ++i) {
+        pthread_create(out->encoders + i, NULL, &output3D_encode, out);
+    }
+
+    return out;
+}
+
+Output3D* output3D_stream(FILE* stream, const int format, const uint32_t width, const uint32_t height, const uint32_t fps, const uint32_t buffers)
+{
+    if (format == TRACY_STREAM_Y4M) {
+        fprintf(stream, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", width, height, fps);
+    }
+
+    Output3D* out = output3D_create(width, height, buffers, 1);
+    pthread_mutex_lock(&out->lock);
+    out->stream = stream;
+    out->stream_write = format == TRACY_STREAM_Y4M ? &stream_write_y4m : &image_write_rgb;
+    pthread_mutex_unlock(&out->lock);
+    return out;
+}
+
+uint8_t* output3D_acquire(Output3D* out)
+{
+    pthread_mutex_lock(&out->lock);
+    while (!out->free_count) {
+        pthread_cond_wait(&out->released, &out->lock);
+    }
+    uint8_t* pixels = out->buffers[--out->free_count];
+    pthread_mutex_unlock(&out->lock);
+    return pixels;
+}
+
+void output3D_submit(Output3D* out, uint8_t* pixels, const char* path)
+{
+    OutputJob job = {pixels, NULL};
+    if (path) {
+        const size_t size = strlen(path) + 1;
+        job.path = malloc(size);
+        memcpy(job.path, path, size);
+    }
+
+    pthread_mutex_lock(&out->lock);
+    out->queue[(out->head + out->queued++) % out->buffer_count] = job;
+    pthread_cond_signal(&out->submitted);
+    pthread_mutex_unlock(&out->lock);
+}
+
+void output3D_flush(Output3D* out)
+{
+    pthread_mutex_lock(&out->lock);
+    while (out->queued || out->free_count < out->buffer_count) {
+        pthread_cond_wait(&out->released, &out->lock);
+    }
+    pthread_mutex_unlock(&out->lock);
+}
+
+int output3D_free(Output3D* out)
+{
+    pthread_mutex_lock(&out->lock);
+    out->done = true;
+    pthread_cond_broadcast(&out->submitted);
+    pthread_mutex_unlock(&out->lock);
+
+    for (uint32_t i = 0; i < out->encoder_count; ++i) {
+        pthread_join(out->encoders[i], NULL);
+    }
+
+    if (out->stream && fflush(out->stream)) {
+        out->status = EXIT_FAILURE;
+    }
+
+    const int status = out->status;
+    for (uint32_t i = 0; i < out->buffer_count; ++i) {
+        free(out->pool[i]);
+    }
+
+    pthread_cond_destroy(&out->submitted);
+    pthread_cond_destroy(&out->released);
+    pthread_mutex_destroy(&out->lock);
+    free(out->encoders);
+    free(out->pool);
+    free(out->buffers);
+    free(out->queue);
+    free(out);
+    return status;
+}
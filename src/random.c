@@ -0,0 +1,47 @@
+#include <tracy.h>
+
+/*
+ * random numbers
+ *
+ * Every thread draws from its own xorshift64* state instead of the shared
+ * rand() of the c library, which takes a lock on every call and leaves the
+ * sample sequence to thread scheduling. Threads that are not seeded take
+ * the next stream of the base seed on their first draw. Distributed work
+ * units seed every row from the unit seed, so a unit renders the same
+ * samples on any worker with any number of threads.
+ */
+
+__thread uint64_t rand3D_state = 0;
+
+static uint64_t rand3D_base_seed = 0;
+static uint64_t rand3D_streams = 0;
+
+/* splitmix64 finalizer of a combined with b */
+uint64_t rand3D_hash(const uint64_t a, const uint64_t b)
+{
+    uint64_t z = a + 0x9E3779B97F4A7C15ull * (b + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void rand3D_seed(const uint64_t seed)
+{
+    /* xorshift never leaves a zero state */
+    rand3D_state = rand3D_hash(seed, 0) | 1;
+}
+
+/* the calling thread and threads first drawing after it start over from the streams of seed */
+void rand3D_base(const uint64_t seed)
+{
+    __atomic_store_n(&rand3D_base_seed, seed, __ATOMIC_RELAXED);
+    __atomic_store_n(&rand3D_streams, 0, __ATOMIC_RELAXED);
+    rand3D_attach();
+}
+
+uint64_t rand3D_attach(void)
+{
+    const uint64_t stream = __atomic_fetch_add(&rand3D_streams, 1, __ATOMIC_RELAXED);
+    rand3D_seed(rand3D_hash(__atomic_load_n(&rand3D_base_seed, __ATOMIC_RELAXED), stream));
+    return rand3D_state;
+}
@@ -9,17 +9,23 @@
 typedef struct JobInfo {
     Render3D* render;
     Scene3D* scene;
+    uint32_t* rows;
     uint32_t start;
     uint32_t end;
+    uint32_t slot;
+    bool report;
 } JobInfo;
 
-static JobInfo render3D_job_info(const Render3D* restrict render, const Scene3D* restrict scene, const uint32_t start, const uint32_t end)
+static JobInfo render3D_job_info(const Render3D* restrict render, const Scene3D* restrict scene, uint32_t* rows, const uint32_t start, const uint32_t end, const uint32_t slot, const bool report)
 {
     JobInfo job;
     job.render = (Render3D*)(size_t)render;
     job.scene = (Scene3D*)(size_t)scene;
+    job.rows = rows;
     job.start = start;
     job.end = end;
+    job.slot = slot;
+    job.report = report;
     return job;
 }
 
@@ -31,83 +37,245 @@ static inline vec3 vec3_tonemap(const vec3 x)
     return _vec3_op(A, /, B);
 }
 
-static void* render3D_render_job(void* arg)
+static inline vec3 render3D_sample(const Scene3D* restrict scene, const Cam3D* restrict cam, const uint32_t x, const uint32_t y, const uint32_t spp, const float invWidth, const float invHeight)
 {
-    const JobInfo job = *(JobInfo*)arg;
-    const uint32_t width = job.render->width;
-    const uint32_t height = job.render->height;
-    const uint32_t spp = job.render->spp;
-    
-#ifdef TRACY_PERF
+    vec3 col = {0.0, 0.0, 0.0};
+    for (uint32_t s = 0; s < spp; s++) {
+        float u = ((float)x + rand3D_norm()) * invWidth;
+        float v = ((float)y + rand3D_norm()) * invHeight;
+        Ray3D r = cam3D_ray(cam, u, v);
+        col = vec3_add(col, ray3D_trace(scene, &r, 0));
+    }
+    return col;
+}
 
-    static volatile bool first = true;
-    static volatile uint32_t frame = 1;
-    
-    bool check = first;
-    first = false;
+/*
+ * sums spp linear radiance samples per pixel into a tile sized rgb float
+ * buffer. Every row draws from its own stream of seed, so the sums do not
+ * depend on how the rows are split between threads.
+ */
+void render3D_tile_accum(const Render3D* restrict render, const Scene3D* restrict scene, const Cam3D* restrict cam, float* restrict accum, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1, const uint32_t spp, const uint64_t seed)
+{
+    const float invWidth = 1.0f / render->width;
+    const float invHeight = 1.0f / render->height;
+    const double start = timeline3D_begin();
 
-    double time = 0.0;
-    if (check) {
-        time = time_clock();
+    for (uint32_t y = y0; y < y1; ++y) {
+        rand3D_seed(rand3D_hash(seed, y));
+        for (uint32_t x = x0; x < x1; ++x) {
+            const vec3 col = render3D_sample(scene, cam, x, y, spp, invWidth, invHeight);
+            accum[0] = col.x;
+            accum[1] = col.y;
+            accum[2] = col.z;
+            accum += 3;
+        }
     }
 
-#endif
+    timeline3D_end("tile", start, (int32_t)x0, (int32_t)y0);
+}
+
+/* 
+ * feature path: averages the first hit of every sample into the enabled
+ * aov buffers, blended over frames like the color buffer. Depth keeps the
+ * nearest hit of the pixel and ids are taken from that nearest sample.
+ */
+
+static inline void render3D_blend3(float* restrict dst, const vec3 v, const float prevFac, const float colFac)
+{
+    dst[0] = dst[0] * prevFac + v.x * colFac;
+    dst[1] = dst[1] * prevFac + v.y * colFac;
+    dst[2] = dst[2] * prevFac + v.z * colFac;
+}
+
+static void render3D_tile_aov(const Render3D* restrict render, const Scene3D* restrict scene, const Cam3D* restrict cam, uint8_t* restrict buffer, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1)
+{
+    const uint32_t width = render->width;
+    const uint32_t height = render->height;
+    const uint32_t spp = render->spp;
 
-    uint8_t* backbuffer = job.render->buffer + job.start * width * 4;
     const float invSpp = 1.0f / (float)spp;
     const float invWidth = 1.0f / width;
     const float invHeight = 1.0f / height;
-    const float colFac = 1.0 / (float)(job.render->timer + 1);
+    const float colFac = 1.0 / (float)(render->timer + 1);
     const float prevFac = 1.0 - colFac;
 
-    for (uint32_t y = job.start; y < job.end; ++y) {
-        for (uint32_t x = 0; x < job.render->width; ++x) {
-            vec3 col = {0.0, 0.0, 0.0};
+    float* const* aovs = render->aov;
+
+    for (uint32_t y = y0; y < y1; ++y) {
+        uint8_t* backbuffer = buffer + ((size_t)y * width + x0) * 4;
+        for (uint32_t x = x0; x < x1; ++x) {
+            const size_t i = (size_t)y * width + x;
+            vec3 col = {0.0, 0.0, 0.0}, n = col, a = col, direct = col, indirect = col;
+            float d = TRACY_MAX_DIST, material = -1.0f, object = -1.0f;
             for (uint32_t s = 0; s < spp; s++) {
-                float u = ((float)x + frand_norm()) * invWidth;
-                float v = ((float)y + frand_norm()) * invHeight;
-                Ray3D r = cam3D_ray(&job.scene->cam, u, v);
-                col = vec3_add(col, ray3D_trace(job.scene, &r, 0));
+                float u = ((float)x + rand3D_norm()) * invWidth;
+                float v = ((float)y + rand3D_norm()) * invHeight;
+                Ray3D r = cam3D_ray(cam, u, v);
+                Aov3D aov;
+                col = vec3_add(col, ray3D_trace_aov(scene, &r, &aov));
+                n = vec3_add(n, aov.normal);
+                a = vec3_add(a, aov.albedo);
+                direct = vec3_add(direct, aov.direct);
+                indirect = vec3_add(indirect, aov.indirect);
+                if (aov.depth < d || !s) {
+                    d = aov.depth;
+                    material = aov.material;
+                    object = aov.object;
+                }
             }
 
-            col = (vec3){sqrtf(col.x * invSpp), sqrtf(col.y * invSpp), sqrtf(col.z * invSpp)};
-            
+            col = _vec3_mult(col, invSpp);
+            if (aovs[TRACY_AOV_COLOR]) {
+                render3D_blend3(aovs[TRACY_AOV_COLOR] + i * 3, col, prevFac, colFac);
+            }
+            if (aovs[TRACY_AOV_NORMAL]) {
+                render3D_blend3(aovs[TRACY_AOV_NORMAL] + i * 3, vec3_normal(n), prevFac, colFac);
+            }
+            if (aovs[TRACY_AOV_ALBEDO]) {
+                render3D_blend3(aovs[TRACY_AOV_ALBEDO] + i * 3, _vec3_mult(a, invSpp), prevFac, colFac);
+            }
+            if (aovs[TRACY_AOV_DIRECT]) {
+                render3D_blend3(aovs[TRACY_AOV_DIRECT] + i * 3, _vec3_mult(direct, invSpp), prevFac, colFac);
+            }
+            if (aovs[TRACY_AOV_INDIRECT]) {
+                render3D_blend3(aovs[TRACY_AOV_INDIRECT] + i * 3, _vec3_mult(indirect, invSpp), prevFac, colFac);
+            }
+            if (aovs[TRACY_AOV_DEPTH]) {
+                float* depth = aovs[TRACY_AOV_DEPTH] + i;
+                *depth = render->timer && *depth < d ? *depth : d;
+            }
+            if (aovs[TRACY_AOV_MATERIAL]) {
+                aovs[TRACY_AOV_MATERIAL][i] = material;
+            }
+            if (aovs[TRACY_AOV_OBJECT]) {
+                aovs[TRACY_AOV_OBJECT][i] = object;
+            }
+
+            col = (vec3){sqrtf(col.x), sqrtf(col.y), sqrtf(col.z)};
             vec3 prev = {(float)backbuffer[0] / 255.0, (float)backbuffer[1] / 255.0, (float)backbuffer[2] / 255.0};
             col = vec3_add(_vec3_mult(prev, prevFac), _vec3_mult(col, colFac));
-            //col = vec3_tonemap(col);
 
             backbuffer[0] = (unsigned)(CLMPF(col.x) * 255.0);
             backbuffer[1] = (unsigned)(CLMPF(col.y) * 255.0);
             backbuffer[2] = (unsigned)(CLMPF(col.z) * 255.0);
             backbuffer[3] = 255;
             backbuffer += 4;
+        }
+    }
+}
 
-#ifdef TRACY_PERF
-            
-            if (check) {
-                double time_elapsed = time_clock() - time;
-                uint32_t samp = (y - job.start) * width + x + 1, off = (job.end - job.start) * width;
-                float perc = ((float)samp / (float)off) * 100.0f;
-                double time_estimate = time_elapsed * 100.0f / perc;
-                double time_remaining = time_estimate - time_elapsed;
-                printf("\rframe\t%d\t%.01f%%\t( %u\t/ %u\t)\t%.01fs\t\t%.01fs\t\t%.01fs", frame, perc, samp, off, time_elapsed, time_estimate, time_remaining);
-            }
+/* 
+ * heatmap path: traces the usual samples but keeps what they cost instead
+ * of their radiance. Costs are the difference of the thread's counters
+ * around each pixel, so they include everything the samples did, from
+ * octree traversal to light sampling. render3D_heat_resolve turns them
+ * into an image once the whole frame is known.
+ */
 
-#endif
+static inline double render3D_heat_count(const Stats3D* stats, const uint32_t heatmap)
+{
+    switch (heatmap) {
+        case TRACY_HEAT_NODES: return (double)stats->node_visits;
+        case TRACY_HEAT_TESTS: return (double)(stats->triangle_tests + stats->sphere_tests);
+        case TRACY_HEAT_SHADOW: return (double)stats->shadow_rays;
+        default: return time_clock() * 1.0e9;
+    }
+}
 
+static void render3D_tile_heat(const Render3D* restrict render, const Scene3D* restrict scene, const Cam3D* restrict cam, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1)
+{
+    const uint32_t width = render->width;
+    const uint32_t height = render->height;
+    const uint32_t spp = render->spp;
+    const uint32_t heatmap = render->heatmap;
+
+    const double invSpp = 1.0 / (double)spp;
+    const float invWidth = 1.0f / width;
+    const float invHeight = 1.0f / height;
+    const float colFac = 1.0 / (float)(render->timer + 1);
+    const float prevFac = 1.0 - colFac;
+    const Stats3D* stats = stats3D_local();
+
+    for (uint32_t y = y0; y < y1; ++y) {
+        for (uint32_t x = x0; x < x1; ++x) {
+            const double before = render3D_heat_count(stats, heatmap);
+            render3D_sample(scene, cam, x, y, spp, invWidth, invHeight);
+            const float cost = (float)((render3D_heat_count(stats, heatmap) - before) * invSpp);
+
+            float* heat = render->heat + (size_t)y * width + x;
+            *heat = *heat * prevFac + cost * colFac;
         }
     }
+}
 
-#ifdef TRACY_PERF
+static void render3D_tile_color(const Render3D* restrict render, const Scene3D* restrict scene, const Cam3D* restrict cam, uint8_t* restrict buffer, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1)
+{
+    const uint32_t width = render->width;
+    const uint32_t height = render->height;
+    const uint32_t spp = render->spp;
 
-    if (check) {
-        frame++;
-        first = true;
-        printf("\n");
+    const float invSpp = 1.0f / (float)spp;
+    const float invWidth = 1.0f / width;
+    const float invHeight = 1.0f / height;
+    const float colFac = 1.0 / (float)(render->timer + 1);
+    const float prevFac = 1.0 - colFac;
+
+    for (uint32_t y = y0; y < y1; ++y) {
+        uint8_t* backbuffer = buffer + ((size_t)y * width + x0) * 4;
+        for (uint32_t x = x0; x < x1; ++x) {
+            vec3 col = render3D_sample(scene, cam, x, y, spp, invWidth, invHeight);
+
+            col = (vec3){sqrtf(col.x * invSpp), sqrtf(col.y * invSpp), sqrtf(col.z * invSpp)};
+            
+            vec3 prev = {(float)backbuffer[0] / 255.0, (float)backbuffer[1] / 255.0, (float)backbuffer[2] / 255.0};
+            col = vec3_add(_vec3_mult(prev, prevFac), _vec3_mult(col, colFac));
+            //col = vec3_tonemap(col);
+
+            backbuffer[0] = (unsigned)(CLMPF(col.x) * 255.0);
+            backbuffer[1] = (unsigned)(CLMPF(col.y) * 255.0);
+            backbuffer[2] = (unsigned)(CLMPF(col.z) * 255.0);
+            backbuffer[3] = 255;
+            backbuffer += 4;
+        }
     }
+}
 
-#endif
+void render3D_tile(const Render3D* restrict render, const Scene3D* restrict scene, const Cam3D* restrict cam, uint8_t* restrict buffer, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1)
+{
+    const double start = timeline3D_begin();
+    if (render->heatmap) {
+        render3D_tile_heat(render, scene, cam, x0, y0, x1, y1);
+    }
+    else if (render->aovs) {
+        render3D_tile_aov(render, scene, cam, buffer, x0, y0, x1, y1);
+    }
+    else render3D_tile_color(render, scene, cam, buffer, x0, y0, x1, y1);
+    timeline3D_end("tile", start, (int32_t)x0, (int32_t)y0);
+}
+
+static void* render3D_render_job(void* arg)
+{
+    const JobInfo job = *(JobInfo*)arg;
+    const uint32_t width = job.render->width;
+    const double start = time_clock();
+    double report = start;
 
+    /* frames move the camera of the scene itself, replicas only stand in for its geometry */
+    cpu3D_pin(job.slot);
+    const Scene3D* scene = job.render->replicas ? job.render->replicas[cpu3D_node(job.slot)] : job.scene;
+
+    for (uint32_t y = job.start; y < job.end; ++y) {
+        render3D_tile(job.render, scene, &job.scene->cam, job.render->buffer, 0, y, width, y + 1);
+
+        /* the calling thread reports the rows done by all threads */
+        const uint32_t rows = __atomic_add_fetch(job.rows, 1, __ATOMIC_RELAXED);
+        if (job.report && time_clock() - report > 0.25) {
+            report = time_clock();
+            stats3D_log_progress(rows, job.render->height, report - start);
+        }
+    }
+
+    stats3D_local()->busy += time_clock() - start;
     return NULL;
 }
 
@@ -116,30 +284,43 @@ void render3D_render(const Render3D* restrict render, const Scene3D* restrict sc
     const uint32_t thread_count = render->threads;
     const uint32_t chunk = render->height / thread_count;
     
-    uint32_t start = 0, end = chunk;
+    uint32_t start = 0, end = chunk, rows = 0;
+    const double time = time_clock();
+    const double span = timeline3D_begin();
 
     pthread_t threads[thread_count - 1];
     JobInfo jobs[thread_count];
 
     for (uint32_t i = 0; i < thread_count - 1; i++) {
-        jobs[i] = render3D_job_info(render, scene, start, end);
+        jobs[i] = render3D_job_info(render, scene, &rows, start, end, i, false);
         pthread_create(&threads[i], NULL, &render3D_render_job, &jobs[i]);
         start += chunk;
         end += chunk;
     }
     
-    jobs[thread_count - 1] = render3D_job_info(render, scene, start, render->height);
+    jobs[thread_count - 1] = render3D_job_info(render, scene, &rows, start, render->height, thread_count - 1, true);
     render3D_render_job(&jobs[thread_count - 1]);
+    cpu3D_unpin();
 
     for (uint32_t i = 0; i < thread_count - 1; i++) {
         pthread_join(threads[i], NULL);
     }
+
+    stats3D_log_progress(rows, render->height, time_clock() - time);
+    timeline3D_end("render", span, -1, -1);
 }
 
 Render3D render3D_new(const uint32_t width, const uint32_t height, const uint32_t spp)
 {
     Render3D render;
     render.buffer = NULL;
+    for (uint32_t i = 0; i < TRACY_AOV_COUNT; ++i) {
+        render.aov[i] = NULL;
+    }
+    render.aovs = 0;
+    render.heat = NULL;
+    render.heatmap = 0;
+    render.replicas = NULL;
     render.width = width;
     render.height = height;
     render.spp = spp;
@@ -154,11 +335,146 @@ void render3D_set(Render3D* render)
     render->buffer = calloc(render->width * render->height * 4, sizeof(uint8_t));
 }
 
+uint32_t render3D_aov_channels(const uint32_t aov)
+{
+    return aov == TRACY_AOV_DEPTH || aov == TRACY_AOV_MATERIAL || aov == TRACY_AOV_OBJECT ? 1 : 3;
+}
+
+const char* render3D_aov_name(const uint32_t aov)
+{
+    static const char* names[TRACY_AOV_COUNT] = {
+        "color", "depth", "normal", "albedo", "material", "object", "direct", "indirect"
+    };
+    return aov < TRACY_AOV_COUNT ? names[aov] : NULL;
+}
+
+void render3D_set_aovs(Render3D* render, const uint32_t aovs)
+{
+    const size_t pixels = (size_t)render->width * render->height;
+    for (uint32_t i = 0; i < TRACY_AOV_COUNT; ++i) {
+        free(render->aov[i]);
+        render->aov[i] = aovs & TRACY_AOV_BIT(i) ? calloc(pixels * render3D_aov_channels(i), sizeof(float)) : NULL;
+    }
+    render->aovs = aovs;
+}
+
+/* writes the linear color aov back into the 8 bit framebuffer */
+void render3D_resolve(const Render3D* render)
+{
+    const float* color = render->aov[TRACY_AOV_COLOR];
+    const size_t pixels = (size_t)render->width * render->height;
+    uint8_t* buffer = render->buffer;
+    const double start = timeline3D_begin();
+
+    for (size_t i = 0; i < pixels; ++i, color += 3, buffer += 4) {
+        buffer[0] = (unsigned)(CLMPF(sqrtf(color[0])) * 255.0);
+        buffer[1] = (unsigned)(CLMPF(sqrtf(color[1])) * 255.0);
+        buffer[2] = (unsigned)(CLMPF(sqrtf(color[2])) * 255.0);
+        buffer[3] = 255;
+    }
+
+    timeline3D_end("resolve", start, -1, -1);
+}
+
+void render3D_set_heatmap(Render3D* render, const uint32_t heatmap)
+{
+    free(render->heat);
+    render->heat = heatmap ? calloc((size_t)render->width * render->height, sizeof(float)) : NULL;
+    render->heatmap = heatmap;
+}
+
+const char* render3D_heatmap_name(const uint32_t heatmap)
+{
+    static const char* names[TRACY_HEAT_COUNT] = {"off", "nodes", "tests", "shadow", "time"};
+    return heatmap < TRACY_HEAT_COUNT ? names[heatmap] : NULL;
+}
+
+/* black, blue, cyan, green, yellow, red */
+static inline void render3D_heat_color(const float t, uint8_t* pixel)
+{
+    static const float ramp[6][3] = {
+        {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 1.0f},
+        {0.0f, 1.0f, 0.0f}, {1.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}
+    };
+
+    const float f = CLMPF(t) * 5.0f;
+    const int i = f < 4.0f ? (int)f : 4;
+    const float w = f - (float)i;
+    for (int c = 0; c < 3; ++c) {
+        pixel[c] = (unsigned)((ramp[i][c] + (ramp[i + 1][c] - ramp[i][c]) * w) * 255.0f);
+    }
+    pixel[3] = 255;
+}
+
+/*
+ * writes the heat buffer into the framebuffer as false color on a log
+ * scale from zero to the most expensive pixel of the frame, so a few
+ * pathological pixels do not flatten the rest of the image. Returns the
+ * largest cost and the mean cost per sample.
+ */
+float render3D_heat_resolve(const Render3D* render, float* mean)
+{
+    const size_t pixels = (size_t)render->width * render->height;
+    const float* heat = render->heat;
+    const double start = timeline3D_begin();
+    float max = 0.0f;
+    double sum = 0.0;
+
+    for (size_t i = 0; i < pixels; ++i) {
+        max = heat[i] > max ? heat[i] : max;
+        sum += heat[i];
+    }
+
+    const float scale = max > 0.0f ? 1.0f / log1pf(max) : 0.0f;
+    for (size_t i = 0; i < pixels; ++i) {
+        render3D_heat_color(log1pf(heat[i]) * scale, render->buffer + i * 4);
+    }
+
+    if (mean) {
+        *mean = pixels ? (float)(sum / pixels) : 0.0f;
+    }
+
+    timeline3D_end("resolve", start, -1, -1);
+    return max;
+}
+
+/* nearest neighbour copy of the aovs enabled in both renders, src no larger than dst */
+void render3D_upscale(const Render3D* src, const Render3D* dst)
+{
+    const uint32_t aovs = src->aovs & dst->aovs;
+    for (uint32_t i = 0; i < TRACY_AOV_COUNT; ++i) {
+        if (!(aovs & TRACY_AOV_BIT(i))) {
+            continue;
+        }
+
+        const uint32_t channels = render3D_aov_channels(i);
+        const size_t size = sizeof(float) * channels;
+        float* out = dst->aov[i];
+        for (uint32_t y = 0; y < dst->height; ++y) {
+            const float* row = src->aov[i] + (size_t)(y * src->height / dst->height) * src->width * channels;
+            for (uint32_t x = 0; x < dst->width; ++x, out += channels) {
+                memcpy(out, row + (size_t)(x * src->width / dst->width) * channels, size);
+            }
+        }
+    }
+}
+
 void render3D_free(Render3D* render)
 {
     if (render && render->buffer) {
         free(render->buffer);
     }
+    
+    if (render) {
+        for (uint32_t i = 0; i < TRACY_AOV_COUNT; ++i) {
+            free(render->aov[i]);
+            render->aov[i] = NULL;
+        }
+        render->aovs = 0;
+        free(render->heat);
+        render->heat = NULL;
+        render->heatmap = 0;
+    }
 }
 
 bmp_t render3D_bmp(const Render3D* restrict render, const Scene3D* restrict scene)
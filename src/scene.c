@@ -2,22 +2,205 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
-static enum MatType material_type_parse(const char* token)
+/* 
+ * reentrant .scx tokenizer over a memory mapped scene file. Tokens are
+ * delimited by separator symbols and never cross line boundaries.
+ */
+
+typedef struct Token {
+    const char* str;
+    size_t len;
+} Token;
+
+typedef struct Lexer {
+    const char* p;
+    const char* end;
+} Lexer;
+
+static const double lexer_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool lexer_symbol(const char c)
+{
+    switch (c) {
+        case ' ': case '\t': case '\r': case ',': case ':': case ';':
+        case '[': case ']': case '{': case '}': case '(': case ')':
+        case '<': case '>':
+            return true;
+    }
+    return false;
+}
+
+static inline bool lexer_digit(const char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* next token of the current line, comments end the line */
+static bool lexer_token(Lexer* lex, Token* token)
+{
+    const char* p = lex->p;
+    const char* end = lex->end;
+    while (p != end && lexer_symbol(*p)) {
+        ++p;
+    }
+
+    if (p == end || *p == '\n' || *p == '#') {
+        lex->p = p;
+        return false;
+    }
+
+    token->str = p;
+    while (p != end && *p != '\n' && !lexer_symbol(*p)) {
+        ++p;
+    }
+
+    token->len = p - token->str;
+    lex->p = p;
+    return true;
+}
+
+static void lexer_line(Lexer* lex)
+{
+    const char* p = memchr(lex->p, '\n', lex->end - lex->p);
+    lex->p = p ? p + 1 : lex->end;
+}
+
+static inline bool token_is(const Token* token, const char* str)
 {
-    if (!strcmp(token, "l") || !strcmp(token, "L") || !strcmp(token, "lambert") || !strcmp(token, "Lambert")) {
+    const size_t len = strlen(str);
+    return token->len == len && !memcmp(token->str, str, len);
+}
+
+static float token_float_slow(const Token* token)
+{
+    char buf[64];
+    const size_t len = token->len < sizeof(buf) - 1 ? token->len : sizeof(buf) - 1;
+    memcpy(buf, token->str, len);
+    buf[len] = '\0';
+    return strtof(buf, NULL);
+}
+
+/* decimal float parser, anything unusual is handed to strtof */
+static float token_float(const Token* token)
+{
+    const char* p = token->str;
+    const char* end = p + token->len;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool negative = false;
+
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    for (; p != end && lexer_digit(*p); ++p, ++digits) {
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+
+    if (p != end && *p == '.') {
+        for (++p; p != end && lexer_digit(*p); ++p, ++digits, --exponent) {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        int e = 0;
+        bool eneg = false;
+        if (++p != end && (*p == '-' || *p == '+')) {
+            eneg = *p++ == '-';
+        }
+        for (; p != end && lexer_digit(*p) && e < 1000; ++p) {
+            e = e * 10 + (*p - '0');
+        }
+        exponent += eneg ? -e : e;
+    }
+
+    if (p != end || digits > 19 || exponent < -22 || exponent > 22) {
+        return token_float_slow(token);
+    }
+
+    double d = (double)mantissa;
+    d = exponent < 0 ? d / lexer_pow10[-exponent] : d * lexer_pow10[exponent];
+    return (float)(negative ? -d : d);
+}
+
+static size_t token_index(const Token* token)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < token->len && lexer_digit(token->str[i]); ++i) {
+        n = n * 10 + (token->str[i] - '0');
+    }
+    return n;
+}
+
+/* read up to count floats from the rest of the line */
+static size_t lexer_floats(Lexer* lex, float* f, const size_t count)
+{
+    Token token;
+    size_t i;
+    for (i = 0; i < count && lexer_token(lex, &token); ++i) {
+        f[i] = token_float(&token);
+    }
+    return i;
+}
+
+static enum MatType material_type_parse(const Token* token)
+{
+    if (token_is(token, "l") || token_is(token, "L") || token_is(token, "lambert") || token_is(token, "Lambert")) {
         return Lambert;
     }
-    else if (!strcmp(token, "m") || !strcmp(token, "M") || !strcmp(token, "metal") || !strcmp(token, "Metal")) {
+    else if (token_is(token, "m") || token_is(token, "M") || token_is(token, "metal") || token_is(token, "Metal")) {
         return Metal;
     }
-    else if (!strcmp(token, "d") || !strcmp(token, "D") || !strcmp(token, "dielectric") || !strcmp(token, "Dielectric")) {
+    else if (token_is(token, "d") || token_is(token, "D") || token_is(token, "dielectric") || token_is(token, "Dielectric")) {
         return Dielectric;
     }
     return Invisible;
 }
 
-static Scene3D* scene3D_new(void)
+static void scene3D_reserve(struct vector* vector, const size_t count)
+{
+    if (count > vector->capacity) {
+        vector->data = realloc(vector->data, count * vector->bytes);
+        vector->capacity = count;
+    }
+}
+
+/* count primitives up front so scene arrays are allocated only once */
+static void scene3D_reserve_text(Scene3D* scene, const char* data, const size_t size)
+{
+    Lexer lex = {data, data + size};
+    size_t materials = 0, spheres = 0, triangles = 0;
+    Token token;
+
+    while (lex.p != lex.end) {
+        if (lexer_token(&lex, &token)) {
+            if (token_is(&token, "s") || token_is(&token, "sphere")) {
+                ++spheres;
+            }
+            else if (token_is(&token, "t") || token_is(&token, "triangle")) {
+                ++triangles;
+            }
+            else if (token_is(&token, "m") || token_is(&token, "mat") || token_is(&token, "material")) {
+                ++materials;
+            }
+        }
+        lexer_line(&lex);
+    }
+
+    scene3D_reserve(&scene->materials, materials);
+    scene3D_reserve(&scene->spheres, spheres);
+    scene3D_reserve(&scene->sphere_materials, spheres);
+    scene3D_reserve(&scene->triangles, triangles);
+    scene3D_reserve(&scene->triangle_materials, triangles);
+}
+
+Scene3D* scene3D_new(void)
 {
     Scene3D* scene = malloc(sizeof(Scene3D));
 
@@ -28,22 +211,59 @@ static Scene3D* scene3D_new(void)
     scene->triangle_materials = vector_create(sizeof(size_t)); 
     scene->models = vector_create(sizeof(Model3D*));
     scene->background_color = vec3_new(0.2, 0.2, 1.0);
+    scene->map = NULL;
+    scene->map_size = 0;
     
     return scene;
 }
 
-Scene3D* scene3D_load(const char* filename, const float aspect)
+static Model3D* scene3D_load_model(Lexer* lex, const Token* path, const uint32_t lazy)
 {
-    static const char* symbols = "\n ,:;[]{}()<>";
+    char filename[BUFSIZ];
+    if (path->len >= sizeof(filename)) {
+        fprintf(stderr, "tracy error: Model path '%.*s' is too long.\n", (int)path->len, path->str);
+        return NULL;
+    }
 
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        printf("Could not open file '%s'.\n", filename);
+    memcpy(filename, path->str, path->len);
+    filename[path->len] = '\0';
+
+    Model3D* model = model3D_open(filename);
+    if (!model) {
         return NULL;
     }
 
-    Scene3D* scene = scene3D_new();
-    
+    model->lazy = lazy;
+
+    Token token;
+    while (lexer_token(lex, &token)) {
+        if (token_is(&token, "scale")) {
+            vec3 scale = vec3_uni(1.0);
+            lexer_floats(lex, (float*)&scale, 3);
+            model3D_scale3D(model, scale);
+        } 
+        else if (token_is(&token, "move")) {
+            vec3 move = vec3_uni(0.0);
+            lexer_floats(lex, (float*)&move, 3);
+            model3D_move(model, move);
+        }
+        else if (token_is(&token, "velocity")) {
+            lexer_floats(lex, (float*)&model->anim.move, 3);
+        }
+        else if (token_is(&token, "spin")) {
+            float degrees = 0.0;
+            lexer_floats(lex, (float*)&model->anim.axis, 3);
+            lexer_floats(lex, &degrees, 1);
+            model->anim.angle = degrees * M_PI / 180.0;
+        }
+    }
+
+    model3D_rebuild(model);
+    return model;
+}
+
+static bool scene3D_parse(Scene3D* scene, const char* data, const size_t size, const float aspect, const uint32_t lazy)
+{
     vec3 lookfrom = vec3_new(0.0, 0.0, -2.0);
     vec3 lookat = vec3_uni(0.0);
     vec3 up = vec3_new(0.0, 1.0, 0.0);
@@ -52,244 +272,149 @@ Scene3D* scene3D_load(const char* filename, const float aspect)
     float aperture = 0.1;
     float focus = 2.0;
 
-    char line[BUFSIZ];
-    while ((fgets(line, BUFSIZ, file))) {
+    scene3D_reserve_text(scene, data, size);
+
+    Lexer lex = {data, data + size};
+    Token cmd, arg;
+
+    for (; lex.p != lex.end; lexer_line(&lex)) {
 
-        char* token = strtok(line, symbols);
-        if (!token || *token == '#') {
+        if (!lexer_token(&lex, &cmd)) {
             continue;
         }
-        else if (!strcmp(token, "model") || !strcmp(token, "load")) {
-            
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
 
-            Model3D* model = model3D_load(token);
-            if (!model) {
-                continue;
+        const bool unary = !(token_is(&cmd, "sky") || token_is(&cmd, "background"));
+        if (unary && !lexer_token(&lex, &arg)) {
+            if (token_is(&cmd, "model") || token_is(&cmd, "load") ||
+                token_is(&cmd, "m") || token_is(&cmd, "mat") || token_is(&cmd, "material") ||
+                token_is(&cmd, "s") || token_is(&cmd, "sphere") || 
+                token_is(&cmd, "t") || token_is(&cmd, "triangle") ||
+                token_is(&cmd, "lookfrom") || token_is(&cmd, "origin") ||
+                token_is(&cmd, "lookat") || token_is(&cmd, "direction") || token_is(&cmd, "up") ||
+                token_is(&cmd, "fov") || token_is(&cmd, "aperture") || token_is(&cmd, "focus")) {
+                fprintf(stderr, "tracy error: No argument for '%.*s' command.\n", (int)cmd.len, cmd.str);
+                return false;
             }
+            continue;
+        }
 
-            token = strtok(token + strlen(token) + 1, symbols);
-
-            while (token) {
-
-                if (!strcmp(token, "#")) {
-                    break;
-                }
-                else if (!strcmp(token, "scale")) {
-                    vec3 scale = vec3_uni(1.0);
-                    const size_t size = sizeof(vec3) / sizeof(float);
-                    float *f = (float*)&scale;
-                    for (size_t i = 0; i < size; ++i) {
-                        if (!(token = strtok(NULL, symbols))) {
-                            break;
-                        }
-                        sscanf(token, "%f", f++);
-                    }
-                    model3D_scale3D(model, scale);
-                } 
-                else if (!strcmp(token, "move")) {
-                    vec3 move = vec3_uni(0.0);
-                    const size_t size = sizeof(vec3) / sizeof(float);
-                    float *f = (float*)&move;
-                    for (size_t i = 0; i < size; ++i) {
-                        if (!(token = strtok(NULL, symbols))) {
-                            break;
-                        }
-                        sscanf(token, "%f", f++);
-                    }
-                    model3D_move(model, move);
-                }
-
-                if (!token) {
-                    break;
-                }
-
-                token = strtok(NULL, symbols);
+        if (token_is(&cmd, "model") || token_is(&cmd, "load")) {
+            Model3D* model = scene3D_load_model(&lex, &arg, lazy);
+            if (model) {
+                vector_push(&scene->models, &model);
             }
-
-            oct3D_free(&model->octree);
-            model->octree = oct3D_from_mesh(model->triangles.data, model->triangles.size);
-            vector_push(&scene->models, &model);
-
         }
-        else if (!strcmp(token, "sky") || !strcmp(token, "background")) {
-            
-            float *f = (float*)&scene->background_color;
-            const size_t size = sizeof(vec3) / sizeof(float);
-            
-            for (size_t i = 0; i < size; ++i) {
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-                sscanf(token, "%f", f++);
-            }
+        else if (!unary) {
+            lexer_floats(&lex, (float*)&scene->background_color, 3);
         }
-        else if (!strcmp(token, "m") || !strcmp(token, "mat") || !strcmp(token, "material")) {
-            
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            const enum MatType type = material_type_parse(token);
-            Material m = {type, {0.5, 0.5, 0.5}, {0.0, 0.0, 0.0}, 0.0, 0.0};
-
-            float *f = (float*)&m.albedo;
-            const size_t size = (sizeof(Material) - sizeof(enum MatType)) / sizeof(float);
-
-            for (size_t i = 0; i < size; ++i) {
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-                sscanf(token, "%f", f++);
-            }
+        else if (token_is(&cmd, "m") || token_is(&cmd, "mat") || token_is(&cmd, "material")) {
+            Material m = {material_type_parse(&arg), {0.5, 0.5, 0.5}, {0.0, 0.0, 0.0}, 0.0, 0.0};
+            lexer_floats(&lex, (float*)&m.albedo, (sizeof(Material) - sizeof(enum MatType)) / sizeof(float));
             vector_push(&scene->materials, &m);
         }
-        else if (!strcmp(token, "s") || !strcmp(token, "sphere")) {
-            
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            size_t material_index;
-            sscanf(token, "%zu", &material_index);
-            vector_push(&scene->sphere_materials, &material_index);
-            
+        else if (token_is(&cmd, "s") || token_is(&cmd, "sphere")) {
+            const size_t material_index = token_index(&arg);
             Sphere s = {{0.0, 0.0, 0.0}, 1.0};
-            float *f = (float*)&s;  
-            const size_t size = sizeof(Sphere) / sizeof(float);
-
-            for (size_t i = 0; i < size; ++i) {
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-                sscanf(token, "%f", f++);
-            }
+            lexer_floats(&lex, (float*)&s, sizeof(Sphere) / sizeof(float));
+            vector_push(&scene->sphere_materials, &material_index);
             vector_push(&scene->spheres, &s);
         }
-        else if (!strcmp(token, "t") || !strcmp(token, "triangle")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            size_t material_index;
-            sscanf(token, "%zu", &material_index);
-            vector_push(&scene->triangle_materials, &material_index);
-            
+        else if (token_is(&cmd, "t") || token_is(&cmd, "triangle")) {
+            const size_t material_index = token_index(&arg);
             Tri3D tri = {_vec3_uni(0.0), _vec3_uni(0.0), _vec3_uni(0.0)};
-            float *f = (float*)&tri;
-            const size_t size = sizeof(Tri3D) / sizeof(float);
-
-            for (size_t i = 0; i < size; ++i) {
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-                sscanf(token, "%f", f++);
-            }
+            lexer_floats(&lex, (float*)&tri, sizeof(Tri3D) / sizeof(float));
+            vector_push(&scene->triangle_materials, &material_index);
             vector_push(&scene->triangles, &tri);
         }
-        else if (!strcmp(token, "lookfrom") || !strcmp(token, "origin")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            float *f = (float*)&lookfrom;
-            const size_t size = sizeof(vec3) / sizeof(float);
-            for (size_t i = 0; i < size; ++i) {
-                sscanf(token, "%f", f++);
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-            }         
+        else if (token_is(&cmd, "lookfrom") || token_is(&cmd, "origin")) {
+            lookfrom.x = token_float(&arg);
+            lexer_floats(&lex, &lookfrom.y, 2);
         }
-        else if (!strcmp(token, "lookat") || !strcmp(token, "direction")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            float *f = (float*)&lookat;
-            const size_t size = sizeof(vec3) / sizeof(float);
-            for (size_t i = 0; i < size; ++i) {
-                sscanf(token, "%f", f++);
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-            }         
+        else if (token_is(&cmd, "lookat") || token_is(&cmd, "direction")) {
+            lookat.x = token_float(&arg);
+            lexer_floats(&lex, &lookat.y, 2);
         }
-        else if (!strcmp(token, "up")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            float *f = (float*)&up;
-            const size_t size = sizeof(vec3) / sizeof(float);
-            for (size_t i = 0; i < size; ++i) {
-                sscanf(token, "%f", f++);
-                if (!(token = strtok(NULL, symbols))) {
-                    break;
-                }
-            }         
+        else if (token_is(&cmd, "up")) {
+            up.x = token_float(&arg);
+            lexer_floats(&lex, &up.y, 2);
         }
-        else if (!strcmp(token, "fov")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            sscanf(token, "%f", &fov);            
+        else if (token_is(&cmd, "fov")) {
+            fov = token_float(&arg);
         }
-        else if (!strcmp(token, "aperture")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            sscanf(token, "%f", &aperture);            
+        else if (token_is(&cmd, "aperture")) {
+            aperture = token_float(&arg);
         }
-        else if (!strcmp(token, "focus")) {
-            token = strtok(NULL, symbols);
-            if (!token) {
-                fprintf(stderr, "tracy error: No argument for '%s' command.\n", token);
-                fclose(file);
-                return NULL;
-            }
-
-            sscanf(token, "%f", &focus);            
+        else if (token_is(&cmd, "focus")) {
+            focus = token_float(&arg);
         }
     }
-    fclose(file);
 
     scene->cam = cam3D_new(lookfrom, lookat, up, fov, aspect, aperture, focus);
+    return true;
+}
+
+static Scene3D* scene3D_load_levels(const char* filename, const float aspect, const uint32_t lazy)
+{
+    const double start = timeline3D_begin();
+    size_t size = 0;
+    char* data = file_map(filename, &size);
+    if (!data) {
+        printf("Could not open file '%s'.\n", filename);
+        return NULL;
+    }
+
+    Scene3D* scene;
+    if (scene3D_is_binary(data, size)) {
+        file_unmap(data, size);
+        scene = scene3D_load_binary(filename, aspect, lazy);
+    }
+    else {
+        scene = scene3D_new();
+        const bool ok = scene3D_parse(scene, data, size, aspect, lazy);
+        file_unmap(data, size);
+        if (!ok) {
+            scene3D_free(scene);
+            scene = NULL;
+        }
+    }
+
+    timeline3D_end("scene load", start, -1, -1);
     return scene;
 }
 
-void scene3D_write(const char* filename, const Scene3D* scene)
+Scene3D* scene3D_load(const char* filename, const float aspect)
+{
+    return scene3D_load_levels(filename, aspect, 0);
+}
+
+Scene3D* scene3D_load_lazy(const char* filename, const float aspect)
+{
+    return scene3D_load_levels(filename, aspect, TRACY_LAZY_LEVELS);
+}
+
+/* a model is written in its rest pose, so its animation starts over on load */
+static bool scene3D_write_obj(const char* filename, const Model3D* model)
+{
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        fprintf(stderr, "tracy error: Could not write file '%s'.\n", filename);
+        return false;
+    }
+
+    const struct vector* mesh = model->rest.size ? &model->rest : &model->triangles;
+    const vec3* v = mesh->data;
+    for (size_t i = 0; i < mesh->size * 3; ++i) {
+        fprintf(file, "v %f %f %f\n", v[i].x, v[i].y, v[i].z);
+    }
+
+    for (size_t i = 0; i < mesh->size; ++i) {
+        fprintf(file, "f %zu %zu %zu\n", i * 3 + 1, i * 3 + 2, i * 3 + 3);
+    }
+
+    return !fclose(file);
+}
+
+int scene3D_write(const char* filename, const Scene3D* scene)
 {
     static const char* matname[4] = {
         "undefined",
@@ -301,7 +426,7 @@ void scene3D_write(const char* filename, const Scene3D* scene)
     FILE* file = fopen(filename, "w");
     if (!file) {
         fprintf(stderr, "tracy error: Could not write file '%s'.\n", filename);
-        return;
+        return EXIT_FAILURE;
     }
 
     fprintf(file, "# tracy 3D scene\n\n# camera:\n");
@@ -376,10 +501,38 @@ void scene3D_write(const char* filename, const Scene3D* scene)
         }
     }
 
-    fclose(file);
+    /* models go to obj files next to the scene, named after it */
+    const size_t model_count = scene->models.size;
+    Model3D** models = scene->models.data;
+    const char* dot = strrchr(filename, '.');
+    const int len = dot && !strchr(dot, '/') ? (int)(dot - filename) : (int)strlen(filename);
+    bool ok = true;
+    if (model_count) {
+        fprintf(file, "# models\n");
+    }
+
+    for (size_t i = 0; ok && i < model_count; ++i) {
+        const Model3D* model = models[i];
+        char path[BUFSIZ];
+        snprintf(path, sizeof(path), "%.*s.model%zu.obj", len, filename, i);
+        ok = scene3D_write_obj(path, model);
+
+        fprintf(file, "load %s", path);
+        if (model->anim.move.x != 0.0 || model->anim.move.y != 0.0 || model->anim.move.z != 0.0) {
+            fprintf(file, " velocity {%f, %f, %f}", model->anim.move.x, model->anim.move.y, model->anim.move.z);
+        }
+        if (model->anim.angle != 0.0) {
+            fprintf(file, " spin {%f, %f, %f} %f", model->anim.axis.x, model->anim.axis.y, model->anim.axis.z, model->anim.angle * 180.0 / M_PI);
+        }
+        fprintf(file, "\n");
+    }
+
+    ok = !fclose(file) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-bool scene3D_hit(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D* restrict outHit, size_t* restrict outID)
+/* object ids number models first, then loose triangles, then spheres */
+static inline bool scene3D_hit_any(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D* restrict outHit, size_t* restrict outID, size_t* restrict outObject)
 {
     Hit3D tmpHit;
     float closest = TRACY_MAX_DIST;
@@ -388,10 +541,14 @@ bool scene3D_hit(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D
     const size_t model_count = scene->models.size;
     const Model3D** models = scene->models.data;
     for (size_t i = 0; i < model_count; ++i) {
-        if (oct3D_hit(&models[i]->octree, ray, &tmpHit, closest)) {
+        const bool hit = models[i]->pack.nodes ?
+            oct3D_pack_hit(&models[i]->pack, ray, &tmpHit, closest) :
+            oct3D_hit(&models[i]->octree, ray, &tmpHit, closest);
+        if (hit) {
             closest = tmpHit.t;
             *outHit = tmpHit;
             *outID = 0;
+            *outObject = i;
             anything = true;
         }
     }
@@ -399,11 +556,15 @@ bool scene3D_hit(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D
     size_t* indices = scene->triangle_materials.data;
     const size_t triangle_count = scene->triangles.size;
     const Tri3D* tri = scene->triangles.data;
+    Stats3D* stats = stats3D_local();
+    stats->triangle_tests += triangle_count;
+    stats->sphere_tests += scene->spheres.size;
     for (size_t i = 0; i < triangle_count; i++) {
         if (tri3D_hit_fast(tri++, ray, &tmpHit, closest)) {
             closest = tmpHit.t;
             *outHit = tmpHit;
             *outID =  indices[i];
+            *outObject = model_count + i;
             anything = true;
         }
     }
@@ -416,6 +577,7 @@ bool scene3D_hit(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D
             closest = tmpHit.t;
             *outHit = tmpHit;
             *outID = indices[i];
+            *outObject = model_count + triangle_count + i;
             anything = true;
         }
     }
@@ -423,6 +585,150 @@ bool scene3D_hit(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D
     return anything;
 }
 
+bool scene3D_hit(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D* restrict outHit, size_t* restrict outID)
+{
+    size_t object;
+    return scene3D_hit_any(scene, ray, outHit, outID, &object);
+}
+
+bool scene3D_hit_object(const Scene3D* restrict scene, const Ray3D* restrict ray, Hit3D* restrict outHit, size_t* restrict outID, size_t* restrict outObject)
+{
+    return scene3D_hit_any(scene, ray, outHit, outID, outObject);
+}
+
+static void scene3D_vector_free(const Scene3D* scene, struct vector* vector)
+{
+    const uint8_t* map = scene->map;
+    const uint8_t* data = vector->data;
+    if (map && data >= map && data < map + scene->map_size) {
+        vector->data = NULL;
+        vector->size = 0;
+    }
+    vector_free(vector);
+}
+
+void scene3D_animate(Scene3D* scene, const uint32_t threads)
+{
+    Model3D** models = scene->models.data;
+    const size_t model_count = scene->models.size;
+    for (size_t i = 0; i < model_count; ++i) {
+        model3D_animate(models[i], threads);
+    }
+}
+
+/* adds every model of the scene to the report, along with what no octree holds */
+void scene3D_report(const Scene3D* scene, OctReport3D* report)
+{
+    Model3D** models = scene->models.data;
+    for (size_t i = 0; i < scene->models.size; ++i) {
+        model3D_report(models[i], report);
+    }
+
+    report->loose_triangles += scene->triangles.size;
+    report->spheres += scene->spheres.size;
+}
+
+void scene3D_compact(Scene3D* scene)
+{
+    Model3D** models = scene->models.data;
+    for (size_t i = 0; i < scene->models.size; ++i) {
+        model3D_compact(models[i]);
+    }
+}
+
+bool scene3D_animated(const Scene3D* scene)
+{
+    Model3D** models = scene->models.data;
+    const size_t model_count = scene->models.size;
+    for (size_t i = 0; i < model_count; ++i) {
+        if (model3D_animated(models[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void scene3D_vector_copy(struct vector* dst, const struct vector* src)
+{
+    scene3D_reserve(dst, src->size);
+    memcpy(dst->data, src->data, src->size * src->bytes);
+    dst->size = src->size;
+}
+
+/* deep copy with rebuilt octrees, its pages belong to the node of the calling thread */
+Scene3D* scene3D_replicate(const Scene3D* scene)
+{
+    Scene3D* copy = scene3D_new();
+    copy->cam = scene->cam;
+    copy->background_color = scene->background_color;
+    scene3D_vector_copy(&copy->materials, &scene->materials);
+    scene3D_vector_copy(&copy->spheres, &scene->spheres);
+    scene3D_vector_copy(&copy->sphere_materials, &scene->sphere_materials);
+    scene3D_vector_copy(&copy->triangles, &scene->triangles);
+    scene3D_vector_copy(&copy->triangle_materials, &scene->triangle_materials);
+
+    Model3D** models = scene->models.data;
+    for (size_t i = 0; i < scene->models.size; ++i) {
+        struct vector triangles = vector_create(sizeof(Tri3D));
+        scene3D_vector_copy(&triangles, &models[i]->triangles);
+        Model3D* model = model3D_new(triangles);
+        model->anim = models[i]->anim;
+        model->lazy = models[i]->lazy;
+        model->compact = models[i]->compact;
+        model3D_rebuild(model);
+        vector_push(&copy->models, &model);
+    }
+
+    return copy;
+}
+
+typedef struct ReplicaJob3D {
+    const Scene3D* scene;
+    Scene3D** replica;
+    uint32_t node;
+} ReplicaJob3D;
+
+static void* scene3D_replicate_job(void* arg)
+{
+    const ReplicaJob3D* job = arg;
+    cpu3D_pin(cpu3D_node_slot(job->node));
+    *job->replica = scene3D_replicate(job->scene);
+    return NULL;
+}
+
+/* one replica per numa node, each built by a thread pinned to its node */
+Scene3D** scene3D_replicate_nodes(const Scene3D* scene)
+{
+    const uint32_t nodes = cpu3D_nodes();
+    Scene3D** replicas = calloc(nodes, sizeof(Scene3D*));
+    pthread_t threads[nodes];
+    ReplicaJob3D jobs[nodes];
+
+    for (uint32_t i = 0; i < nodes; ++i) {
+        jobs[i].scene = scene;
+        jobs[i].replica = replicas + i;
+        jobs[i].node = i;
+        pthread_create(threads + i, NULL, &scene3D_replicate_job, jobs + i);
+    }
+
+    for (uint32_t i = 0; i < nodes; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return replicas;
+}
+
+void scene3D_free_replicas(Scene3D** replicas)
+{
+    if (!replicas) return;
+
+    const uint32_t nodes = cpu3D_nodes();
+    for (uint32_t i = 0; i < nodes; ++i) {
+        scene3D_free(replicas[i]);
+    }
+    free(replicas);
+}
+
 void scene3D_free(Scene3D* scene)
 {
     if (!scene) return;
@@ -430,15 +736,17 @@ void scene3D_free(Scene3D* scene)
     Model3D** models = scene->models.data;
     const size_t model_count = scene->models.size;
     for (size_t i = 0; i < model_count; ++i) {
+        scene3D_vector_free(scene, &models[i]->triangles);
         model3D_free(models[i]);
     }
 
     vector_free(&scene->models);
-    vector_free(&scene->triangles);
-    vector_free(&scene->triangle_materials);
-    vector_free(&scene->spheres);
-    vector_free(&scene->sphere_materials);
-    vector_free(&scene->materials);
+    scene3D_vector_free(scene, &scene->triangles);
+    scene3D_vector_free(scene, &scene->triangle_materials);
+    scene3D_vector_free(scene, &scene->spheres);
+    scene3D_vector_free(scene, &scene->sphere_materials);
+    scene3D_vector_free(scene, &scene->materials);
+    file_unmap(scene->map, scene->map_size);
 
     free(scene);
 }
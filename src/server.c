@@ -0,0 +1,571 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * headless render server
+ *
+ * Scenes are loaded once and stay resident with their octrees. Clients
+ * connect to a unix socket and send one request per line, answered by one
+ * line each:
+ *
+ *  scenes                      -> ok <count> followed by '<id> <file>' lines
+ *  render <scene> [options]    -> ok <job> queue <s> render <s> write <s> total <s>
+ *  shutdown                    -> ok, server exits after running jobs
+ *
+ * Render options:
+ *  w <n> h <n> spp <n> o <path>
+ *  lookfrom <x y z> lookat <x y z> up <x y z> fov <f> aperture <f> focus <f>
+ *  material <index> <type> <r g b> [emissive <r g b>] [roughness <f>] [ri <f>]
+ *
+ * <scene> is a scene index or the file name it was loaded from. Failures
+ * are answered with 'error <message>'. Overrides only apply to the job, the
+ * resident scene is never modified so jobs on the same scene run in
+ * parallel. At most 'jobs' renders run at a time and at most 'queue'
+ * requests wait for a slot, further requests are rejected.
+ */
+
+#define SERVER_LINE 4096
+
+typedef struct ServerJob {
+    Scene3D scene;
+    Render3D render;
+    char path[BUFSIZ];
+    char error[256];
+    uint64_t id;
+    double queued;
+    double started;
+    double rendered;
+    double written;
+    bool done;
+    struct ServerJob* next;
+} ServerJob;
+
+typedef struct Server {
+    pthread_mutex_t lock;
+    pthread_cond_t submitted;
+    pthread_cond_t finished;
+    const Render3D* render;
+    Scene3D** scenes;
+    const char* const* names;
+    size_t scene_count;
+    ServerJob* head;
+    ServerJob* tail;
+    uint32_t queued;
+    uint32_t max_queued;
+    uint32_t runners;
+    int* clients;
+    uint32_t connections;
+    uint32_t capacity;
+    uint64_t next_id;
+    bool done;
+} Server;
+
+typedef struct ServerClient {
+    Server* server;
+    int fd;
+} ServerClient;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_signal(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+static bool server_write(const int fd, const char* str)
+{
+    size_t size = strlen(str);
+    while (size) {
+        const ssize_t n = send(fd, str, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        str += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static void* server_run(void* arg)
+{
+    Server* server = arg;
+
+    pthread_mutex_lock(&server->lock);
+    while (true) {
+        while (!server->head && !server->done) {
+            pthread_cond_wait(&server->submitted, &server->lock);
+        }
+
+        ServerJob* job = server->head;
+        if (!job) {
+            break;
+        }
+
+        server->head = job->next;
+        if (!server->head) {
+            server->tail = NULL;
+        }
+        --server->queued;
+        pthread_mutex_unlock(&server->lock);
+
+        job->started = time_clock();
+        Render3D* render = &job->render;
+        render->buffer = calloc((size_t)render->width * render->height * 4, sizeof(uint8_t));
+        render3D_render(render, &job->scene);
+        job->rendered = time_clock();
+
+        if (image_write(job->path, render->buffer, render->width, render->height)) {
+            sprintf(job->error, "could not write '%.200s'", job->path);
+        }
+        free(render->buffer);
+        job->written = time_clock();
+        /* concurrent jobs share the counters, their lines are interval totals */
+        stats3D_log_frame(server->runners == 1 ? job->rendered - job->started : 0.0);
+
+        pthread_mutex_lock(&server->lock);
+        job->done = true;
+        pthread_cond_broadcast(&server->finished);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+typedef struct ServerArgs {
+    char* tokens[256];
+    int count;
+    int index;
+} ServerArgs;
+
+static char* server_next(ServerArgs* args)
+{
+    return args->index < args->count ? args->tokens[args->index++] : NULL;
+}
+
+static bool server_peek(const ServerArgs* args, const char* str)
+{
+    return args->index < args->count && !strcmp(args->tokens[args->index], str);
+}
+
+static bool server_floats(ServerArgs* args, float* out, const int count)
+{
+    for (int i = 0; i < count; ++i) {
+        char* tok = server_next(args);
+        char* end;
+        if (!tok || (out[i] = strtof(tok, &end), *end)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool server_uint(ServerArgs* args, uint32_t* out, const uint32_t max)
+{
+    char* tok = server_next(args);
+    char* end;
+    if (!tok) {
+        return false;
+    }
+    const unsigned long n = strtoul(tok, &end, 10);
+    if (*end || !n || n > max) {
+        return false;
+    }
+    *out = (uint32_t)n;
+    return true;
+}
+
+static bool server_material(ServerArgs* args, Material* materials, const size_t count)
+{
+    uint32_t index;
+    char* tok = server_next(args);
+    char* end;
+    if (!tok || (index = (uint32_t)strtoul(tok, &end, 10), *end) || index >= count) {
+        return false;
+    }
+
+    Material* m = materials + index;
+    tok = server_next(args);
+    if (!tok) {
+        return false;
+    }
+    else if (!strcmp(tok, "lambert") || !strcmp(tok, "l")) {
+        m->type = Lambert;
+    }
+    else if (!strcmp(tok, "metal") || !strcmp(tok, "m")) {
+        m->type = Metal;
+    }
+    else if (!strcmp(tok, "dielectric") || !strcmp(tok, "d")) {
+        m->type = Dielectric;
+    }
+    else return false;
+
+    float f[3];
+    if (!server_floats(args, f, 3)) {
+        return false;
+    }
+    m->albedo = (vec3){f[0], f[1], f[2]};
+
+    /* optional material fields until the next job option */
+    while (true) {
+        if (server_peek(args, "emissive")) {
+            server_next(args);
+            if (!server_floats(args, f, 3)) {
+                return false;
+            }
+            m->emissive = (vec3){f[0], f[1], f[2]};
+        }
+        else if (server_peek(args, "roughness")) {
+            server_next(args);
+            if (!server_floats(args, &m->roughness, 1)) {
+                return false;
+            }
+        }
+        else if (server_peek(args, "ri")) {
+            server_next(args);
+            if (!server_floats(args, &m->ri, 1)) {
+                return false;
+            }
+        }
+        else break;
+    }
+
+    return true;
+}
+
+static const char* server_parse(Server* server, ServerJob* job, char* line, Material** materials)
+{
+    ServerArgs args;
+    char* save;
+    args.count = 0;
+    args.index = 0;
+    for (char* t = strtok_r(line, " \t", &save); t; t = strtok_r(NULL, " \t", &save)) {
+        if (args.count == (int)(sizeof(args.tokens) / sizeof(args.tokens[0]))) {
+            return "too many options";
+        }
+        args.tokens[args.count++] = t;
+    }
+
+    char* tok = server_next(&args);
+    if (!tok) {
+        return "missing scene";
+    }
+
+    char* end;
+    size_t index = strtoul(tok, &end, 10);
+    if (*end) {
+        for (index = 0; index < server->scene_count && strcmp(server->names[index], tok); ++index);
+    }
+    if (index >= server->scene_count) {
+        return "unknown scene";
+    }
+
+    const Scene3D* base = server->scenes[index];
+    Cam3D cam = base->cam;
+    job->scene = *base;
+    job->render = *server->render;
+    job->render.buffer = NULL;
+    job->render.aovs = 0;
+    memset(job->render.aov, 0, sizeof(job->render.aov));
+    job->render.heat = NULL;
+    job->render.heatmap = 0;
+    job->render.replicas = NULL;
+    job->render.timer = 0;
+    strcpy(job->path, "image.png");
+
+    while ((tok = server_next(&args))) {
+        float f[3];
+        if (!strcmp(tok, "w")) {
+            if (!server_uint(&args, &job->render.width, 3840)) return "invalid w";
+        }
+        else if (!strcmp(tok, "h")) {
+            if (!server_uint(&args, &job->render.height, 2160)) return "invalid h";
+        }
+        else if (!strcmp(tok, "spp")) {
+            if (!server_uint(&args, &job->render.spp, 1 << 20)) return "invalid spp";
+        }
+        else if (!strcmp(tok, "o")) {
+            tok = server_next(&args);
+            if (!tok || strlen(tok) >= sizeof(job->path)) return "invalid o";
+            strcpy(job->path, tok);
+        }
+        else if (!strcmp(tok, "lookfrom")) {
+            if (!server_floats(&args, f, 3)) return "invalid lookfrom";
+            cam.lookFrom = (vec3){f[0], f[1], f[2]};
+        }
+        else if (!strcmp(tok, "lookat")) {
+            if (!server_floats(&args, f, 3)) return "invalid lookat";
+            cam.lookAt = (vec3){f[0], f[1], f[2]};
+        }
+        else if (!strcmp(tok, "up")) {
+            if (!server_floats(&args, f, 3)) return "invalid up";
+            cam.up = (vec3){f[0], f[1], f[2]};
+        }
+        else if (!strcmp(tok, "fov")) {
+            if (!server_floats(&args, &cam.fov, 1)) return "invalid fov";
+        }
+        else if (!strcmp(tok, "aperture")) {
+            if (!server_floats(&args, &cam.aperture, 1)) return "invalid aperture";
+        }
+        else if (!strcmp(tok, "focus")) {
+            if (!server_floats(&args, &cam.focusDist, 1)) return "invalid focus";
+        }
+        else if (!strcmp(tok, "material")) {
+            if (!*materials) {
+                *materials = malloc(sizeof(Material) * (base->materials.size + 1));
+                memcpy(*materials, base->materials.data, sizeof(Material) * base->materials.size);
+                job->scene.materials.data = *materials;
+            }
+            if (!server_material(&args, *materials, base->materials.size)) return "invalid material";
+        }
+        else return "unknown option";
+    }
+
+    job->scene.cam = cam3D_new(cam.lookFrom, cam.lookAt, cam.up, cam.fov, (float)job->render.width / (float)job->render.height, cam.aperture, cam.focusDist);
+    return NULL;
+}
+
+static void server_render(Server* server, const int fd, char* line)
+{
+    char reply[512];
+    ServerJob* job = calloc(1, sizeof(ServerJob));
+    Material* materials = NULL;
+
+    const char* error = server_parse(server, job, line, &materials);
+    if (error) {
+        sprintf(reply, "error %s\n", error);
+        server_write(fd, reply);
+        free(materials);
+        free(job);
+        return;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    if (server->done || server->queued >= server->max_queued) {
+        pthread_mutex_unlock(&server->lock);
+        server_write(fd, server->done ? "error shutting down\n" : "error queue full\n");
+        free(materials);
+        free(job);
+        return;
+    }
+
+    job->id = ++server->next_id;
+    job->queued = time_clock();
+    if (server->tail) {
+        server->tail->next = job;
+    }
+    else server->head = job;
+    server->tail = job;
+    ++server->queued;
+    pthread_cond_signal(&server->submitted);
+
+    while (!job->done) {
+        pthread_cond_wait(&server->finished, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (job->error[0]) {
+        sprintf(reply, "error %s\n", job->error);
+    }
+    else {
+        sprintf(reply, "ok %llu queue %.06f render %.06f write %.06f total %.06f\n", (unsigned long long)job->id,
+            job->started - job->queued, job->rendered - job->started, job->written - job->rendered, job->written - job->queued);
+    }
+
+    server_write(fd, reply);
+    free(materials);
+    free(job);
+}
+
+static void* server_client(void* arg)
+{
+    ServerClient client = *(ServerClient*)arg;
+    Server* server = client.server;
+    free(arg);
+
+    char buf[SERVER_LINE];
+    size_t size = 0;
+    bool open = true;
+
+    while (open) {
+        const ssize_t n = recv(client.fd, buf + size, sizeof(buf) - size - 1, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        size += (size_t)n;
+        buf[size] = 0;
+
+        char* line = buf;
+        char* nl;
+        while (open && (nl = strchr(line, '\n'))) {
+            *nl = 0;
+            if (nl > line && nl[-1] == '\r') {
+                nl[-1] = 0;
+            }
+
+            if (!strncmp(line, "render", 6) && (!line[6] || line[6] == ' ' || line[6] == '\t')) {
+                server_render(server, client.fd, line + 6);
+            }
+            else if (!strcmp(line, "scenes")) {
+                char reply[BUFSIZ];
+                sprintf(reply, "ok %zu\n", server->scene_count);
+                open = server_write(client.fd, reply);
+                for (size_t i = 0; open && i < server->scene_count; ++i) {
+                    snprintf(reply, sizeof(reply), "%zu %s\n", i, server->names[i]);
+                    open = server_write(client.fd, reply);
+                }
+            }
+            else if (!strcmp(line, "shutdown")) {
+                server_stop = 1;
+                server_write(client.fd, "ok\n");
+                open = false;
+            }
+            else if (*line) {
+                open = server_write(client.fd, "error unknown request\n");
+            }
+            line = nl + 1;
+        }
+
+        size -= (size_t)(line - buf);
+        memmove(buf, line, size);
+        if (size == sizeof(buf) - 1) {
+            server_write(client.fd, "error request too long\n");
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    uint32_t i = 0;
+    while (server->clients[i] != client.fd) {
+        ++i;
+    }
+    server->clients[i] = server->clients[--server->connections];
+    close(client.fd);
+    pthread_cond_broadcast(&server->finished);
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+int server3D_run(const Render3D* render, Scene3D** scenes, const char* const* names, const size_t scene_count, const char* path, const uint32_t jobs, const uint32_t queue)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return tracy_error("Socket path '%s' is too long.\n", path);
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 64)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return tracy_error("Could not listen on '%s'.\n", path);
+    }
+
+    Server server;
+    memset(&server, 0, sizeof(server));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.submitted, NULL);
+    pthread_cond_init(&server.finished, NULL);
+    server.render = render;
+    server.scenes = scenes;
+    server.names = names;
+    server.scene_count = scene_count;
+    server.max_queued = queue ? queue : 1;
+
+    const uint32_t runner_count = jobs ? jobs : 1;
+    server.runners = runner_count;
+    pthread_t runners[runner_count];
+    for (uint32_t i = 0; i < runner_count; ++i) {
+        pthread_create(runners + i, NULL, &server_run, &server);
+    }
+
+    signal(SIGINT, &server_signal);
+    signal(SIGTERM, &server_signal);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stdout, "tracy server listening on '%s'\n", path);
+    fflush(stdout);
+
+    while (!server_stop) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+
+        ServerClient* client = malloc(sizeof(ServerClient));
+        client->server = &server;
+        client->fd = accept(fd, NULL, NULL);
+        if (client->fd < 0) {
+            free(client);
+            continue;
+        }
+
+        pthread_mutex_lock(&server.lock);
+        if (server.connections == server.capacity) {
+            server.capacity = server.capacity ? server.capacity * 2 : 16;
+            server.clients = realloc(server.clients, sizeof(int) * server.capacity);
+        }
+        server.clients[server.connections++] = client->fd;
+        pthread_mutex_unlock(&server.lock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &server_client, client)) {
+            pthread_mutex_lock(&server.lock);
+            server.clients[--server.connections] = -1;
+            pthread_mutex_unlock(&server.lock);
+            close(client->fd);
+            free(client);
+        }
+        else pthread_detach(thread);
+    }
+
+    close(fd);
+    unlink(path);
+
+    /* running and queued jobs still finish, new requests are rejected */
+    pthread_mutex_lock(&server.lock);
+    server.done = true;
+    pthread_cond_broadcast(&server.submitted);
+    pthread_mutex_unlock(&server.lock);
+
+    for (uint32_t i = 0; i < runner_count; ++i) {
+        pthread_join(runners[i], NULL);
+    }
+
+    /* clients are disconnected once their last job was answered */
+    pthread_mutex_lock(&server.lock);
+    for (uint32_t i = 0; i < server.connections; ++i) {
+        shutdown(server.clients[i], SHUT_RDWR);
+    }
+    while (server.connections) {
+        pthread_cond_wait(&server.finished, &server.lock);
+    }
+    pthread_mutex_unlock(&server.lock);
+
+    pthread_cond_destroy(&server.submitted);
+    pthread_cond_destroy(&server.finished);
+    pthread_mutex_destroy(&server.lock);
+    free(server.clients);
+
+    fprintf(stdout, "tracy server rendered %llu jobs\n", (unsigned long long)server.next_id);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * render statistics
+ *
+ * Every thread counts into its own block, aligned and padded to whole cache
+ * lines so counting is a plain increment that never contends. Blocks are
+ * handed out on first use and go back to a free list when their thread
+ * exits, keeping their counts, so the short lived threads of consecutive
+ * frames reuse the same few blocks. A reset only stores the counts as the
+ * base later reads subtract, so threads may keep counting through it, as
+ * they do when overlapping batch frames and server jobs are reported.
+ */
+
+#define STATS_CACHE_LINE 64
+
+typedef struct StatsBlock3D {
+    Stats3D stats;
+    Stats3D base; /* counts at the last reset */
+    struct StatsBlock3D* next;
+    bool used;
+} StatsBlock3D;
+
+__thread Stats3D* stats3D_current = NULL;
+
+static StatsBlock3D* stats3D_blocks = NULL;
+static pthread_mutex_t stats3D_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats3D_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats3D_key;
+static FILE* stats3D_stream = NULL;
+static pthread_mutex_t stats3D_report_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* stats3D_report_stream = NULL;
+static int stats3D_report_format;
+static uint32_t stats3D_report_frame;
+static uint32_t stats3D_report_frames;
+static double stats3D_report_start;
+static double stats3D_report_since;
+static Stats3D stats3D_lost; /* shared by threads that could not get a block */
+
+static void stats3D_release(void* arg)
+{
+    StatsBlock3D* block = arg;
+    pthread_mutex_lock(&stats3D_lock);
+    block->used = false;
+    pthread_mutex_unlock(&stats3D_lock);
+}
+
+static void stats3D_init(void)
+{
+    pthread_key_create(&stats3D_key, &stats3D_release);
+}
+
+Stats3D* stats3D_attach(void)
+{
+    pthread_once(&stats3D_once, &stats3D_init);
+
+    pthread_mutex_lock(&stats3D_lock);
+    StatsBlock3D** link = &stats3D_blocks;
+    while (*link && (*link)->used) {
+        link = &(*link)->next;
+    }
+
+    StatsBlock3D* block = *link;
+    if (!block) {
+        const size_t size = (sizeof(StatsBlock3D) + STATS_CACHE_LINE - 1) / STATS_CACHE_LINE * STATS_CACHE_LINE;
+        void* memory;
+        if (posix_memalign(&memory, STATS_CACHE_LINE, size)) {
+            pthread_mutex_unlock(&stats3D_lock);
+            stats3D_current = &stats3D_lost;
+            return stats3D_current;
+        }
+
+        block = memory;
+        memset(block, 0, sizeof(StatsBlock3D));
+        *link = block;
+    }
+    block->used = true;
+    pthread_mutex_unlock(&stats3D_lock);
+
+    pthread_setspecific(stats3D_key, block);
+    stats3D_current = &block->stats;
+    return stats3D_current;
+}
+
+static void stats3D_sub(Stats3D* s, const Stats3D* base)
+{
+    s->primary_rays -= base->primary_rays;
+    s->secondary_rays -= base->secondary_rays;
+    s->shadow_rays -= base->shadow_rays;
+    s->node_visits -= base->node_visits;
+    s->triangle_tests -= base->triangle_tests;
+    s->sphere_tests -= base->sphere_tests;
+    for (uint32_t i = 0; i <= TRACY_MAX_DEPTH; ++i) {
+        s->paths[i] -= base->paths[i];
+    }
+    s->busy -= base->busy;
+}
+
+/* copies up to max per thread blocks and returns the number of blocks */
+uint32_t stats3D_read(Stats3D* threads, const uint32_t max, Stats3D* total)
+{
+    uint32_t count = 0;
+    memset(total, 0, sizeof(Stats3D));
+
+    pthread_mutex_lock(&stats3D_lock);
+    for (const StatsBlock3D* block = stats3D_blocks; block; block = block->next, ++count) {
+        Stats3D s = block->stats;
+        stats3D_sub(&s, &block->base);
+        if (count < max) {
+            threads[count] = s;
+        }
+
+        total->primary_rays += s.primary_rays;
+        total->secondary_rays += s.secondary_rays;
+        total->shadow_rays += s.shadow_rays;
+        total->node_visits += s.node_visits;
+        total->triangle_tests += s.triangle_tests;
+        total->sphere_tests += s.sphere_tests;
+        for (uint32_t i = 0; i <= TRACY_MAX_DEPTH; ++i) {
+            total->paths[i] += s.paths[i];
+        }
+        total->busy += s.busy;
+    }
+    pthread_mutex_unlock(&stats3D_lock);
+
+    return count;
+}
+
+void stats3D_reset(void)
+{
+    pthread_mutex_lock(&stats3D_lock);
+    for (StatsBlock3D* block = stats3D_blocks; block; block = block->next) {
+        block->base = block->stats;
+    }
+    pthread_mutex_unlock(&stats3D_lock);
+}
+
+/* per frame reports of batch and server renders, off unless a stream is set */
+void stats3D_report(FILE* stream, const int format, const uint32_t frames)
+{
+    pthread_mutex_lock(&stats3D_report_lock);
+    stats3D_report_stream = stream;
+    stats3D_report_format = format;
+    stats3D_report_frame = 0;
+    stats3D_report_frames = frames;
+    stats3D_report_start = stats3D_report_since = time_clock();
+    pthread_mutex_unlock(&stats3D_report_lock);
+    stats3D_reset();
+}
+
+/*
+ * reports the counts since the previous report, called by whoever finished
+ * a frame. Counts are process wide: while frames or jobs overlap a line
+ * holds the totals of the interval since the previous line, including rays
+ * of frames still running, and span must be 0 so rates are over that
+ * interval. Only a caller that renders one frame at a time may pass the
+ * frame's own render time, which leaves idle time out of the rates.
+ */
+void stats3D_log_frame(const double span)
+{
+    pthread_mutex_lock(&stats3D_report_lock);
+    if (stats3D_report_stream) {
+        const double now = time_clock();
+        tracy_log_stats(stats3D_report_stream, stats3D_report_format, ++stats3D_report_frame, stats3D_report_frames,
+            now - stats3D_report_start, span > 0.0 ? span : now - stats3D_report_since);
+        stats3D_reset();
+        stats3D_report_since = now;
+    }
+    pthread_mutex_unlock(&stats3D_report_lock);
+}
+
+/* live progress of render3D_render, off unless a stream is set */
+void stats3D_progress(FILE* stream)
+{
+    stats3D_stream = stream;
+}
+
+void stats3D_log_progress(const uint32_t done, const uint32_t total, const double elapsed)
+{
+    if (!stats3D_stream || !done) {
+        return;
+    }
+
+    const double estimate = elapsed * total / done;
+    fprintf(stats3D_stream, "\rrendering\t%.01f%%\t(%u / %u rows)\telapsed %.01fs\testimate %.01fs\tremaining %.01fs",
+        100.0 * done / total, done, total, elapsed, estimate, estimate - elapsed);
+    if (done == total) {
+        fprintf(stats3D_stream, "\n");
+    }
+    fflush(stats3D_stream);
+}
@@ -0,0 +1,172 @@
+#include <tracy.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * temporal reprojection for the interactive viewer
+ *
+ * Each frame is traced with the color, depth and normal aovs. Every pixel
+ * reconstructs its world position from the camera and depth, projects it
+ * into the previous camera and fetches the history there with a bilinear
+ * filter. History taps whose depth or normal do not match the new surface
+ * are disoccluded and dropped. The surviving history is blended with the
+ * new sample by its accumulation count, capped while the camera moves so
+ * stale shading fades out. A static camera accumulates without limit,
+ * like the progressive timer did.
+ */
+
+#define TEMPORAL_MOVING_LIMIT 16.0f
+#define TEMPORAL_DEPTH_TOLERANCE 0.05f
+#define TEMPORAL_NORMAL_TOLERANCE 0.9f
+
+#define CLMPF(x) ((x) * ((x) < 1.0) * ((x) > 0.0) + (float)((x) >= 1.0))
+
+Temporal3D temporal3D_create(const uint32_t width, const uint32_t height)
+{
+    const size_t pixels = (size_t)width * height;
+    Temporal3D temporal;
+    temporal.width = width;
+    temporal.height = height;
+    temporal.color = malloc(sizeof(float) * pixels * 3);
+    temporal.normal = malloc(sizeof(float) * pixels * 3);
+    temporal.depth = malloc(sizeof(float) * pixels);
+    temporal.count = malloc(sizeof(float) * pixels);
+    temporal.next = malloc(sizeof(float) * pixels * 4);
+    temporal.valid = false;
+    return temporal;
+}
+
+void temporal3D_reset(Temporal3D* temporal)
+{
+    temporal->valid = false;
+}
+
+static bool temporal3D_same_cam(const Cam3D* a, const Cam3D* b)
+{
+    return !memcmp(&a->lookFrom, &b->lookFrom, sizeof(vec3)) && !memcmp(&a->lookAt, &b->lookAt, sizeof(vec3)) &&
+        !memcmp(&a->up, &b->up, sizeof(vec3)) && a->fov == b->fov && a->aspect == b->aspect;
+}
+
+/* pixel coordinates of a world position in a camera, false when behind it */
+static bool temporal3D_project(const Cam3D* cam, const vec3 pos, const uint32_t width, const uint32_t height, float* px, float* py, float* dist)
+{
+    const vec3 d = _vec3_sub(pos, cam->lookFrom);
+    const float z = -_vec3_dot(d, cam->params.w);
+    if (z <= TRACY_MIN_DIST) {
+        return false;
+    }
+
+    const float halfHeight = tanf(cam->fov * M_PI / 360.0);
+    const float halfWidth = cam->aspect * halfHeight;
+    const float s = (_vec3_dot(d, cam->params.u) / (z * halfWidth) + 1.0f) * 0.5f;
+    const float t = (_vec3_dot(d, cam->params.v) / (z * halfHeight) + 1.0f) * 0.5f;
+
+    *px = s * width - 0.5f;
+    *py = t * height - 0.5f;
+    *dist = vec3_mag(d);
+    return true;
+}
+
+void temporal3D_resolve(Temporal3D* temporal, const Render3D* render, const Cam3D* cam, uint8_t* out)
+{
+    const uint32_t width = temporal->width, height = temporal->height;
+    const float* color = render->aov[TRACY_AOV_COLOR];
+    const float* depth = render->aov[TRACY_AOV_DEPTH];
+    const float* normal = render->aov[TRACY_AOV_NORMAL];
+    const bool moved = temporal->valid && !temporal3D_same_cam(cam, &temporal->cam);
+    const float halfHeight = tanf(cam->fov * M_PI / 360.0);
+    const float halfWidth = cam->aspect * halfHeight;
+    const double start = timeline3D_begin();
+
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            const size_t i = (size_t)y * width + x;
+            const float* n = normal + i * 3;
+            float hist[3] = {0.0f, 0.0f, 0.0f}, count = 0.0f;
+
+            if (temporal->valid && !moved) {
+                memcpy(hist, temporal->color + i * 3, sizeof(hist));
+                count = temporal->count[i];
+            }
+            else if (temporal->valid && depth[i] < TRACY_MAX_DIST) {
+                /* world position of the pixel center at its traced depth */
+                const float s = ((float)x + 0.5f) / width * 2.0f - 1.0f;
+                const float t = ((float)y + 0.5f) / height * 2.0f - 1.0f;
+                const vec3 dir = vec3_normal(vec3_sub(vec3_add(_vec3_mult(cam->params.u, s * halfWidth), _vec3_mult(cam->params.v, t * halfHeight)), cam->params.w));
+                const vec3 pos = _vec3_add(cam->lookFrom, _vec3_mult(dir, depth[i]));
+
+                float px, py, dist;
+                if (temporal3D_project(&temporal->cam, pos, width, height, &px, &py, &dist)) {
+                    const int x0 = (int)floorf(px), y0 = (int)floorf(py);
+                    const float fx = px - x0, fy = py - y0;
+                    float total = 0.0f;
+                    for (int j = 0; j < 4; ++j) {
+                        const int hx = x0 + (j & 1), hy = y0 + (j >> 1);
+                        if (hx < 0 || hy < 0 || hx >= (int)width || hy >= (int)height) {
+                            continue;
+                        }
+
+                        const size_t h = (size_t)hy * width + hx;
+                        const float* hn = temporal->normal + h * 3;
+                        const float dz = temporal->depth[h] - dist;
+                        if ((dz < 0.0f ? -dz : dz) > TEMPORAL_DEPTH_TOLERANCE * dist ||
+                            hn[0] * n[0] + hn[1] * n[1] + hn[2] * n[2] < TEMPORAL_NORMAL_TOLERANCE) {
+                            continue;
+                        }
+
+                        const float w = ((j & 1) ? fx : 1.0f - fx) * ((j >> 1) ? fy : 1.0f - fy);
+                        hist[0] += temporal->color[h * 3 + 0] * w;
+                        hist[1] += temporal->color[h * 3 + 1] * w;
+                        hist[2] += temporal->color[h * 3 + 2] * w;
+                        count += temporal->count[h] * w;
+                        total += w;
+                    }
+
+                    if (total > 0.0f) {
+                        const float inv = 1.0f / total;
+                        hist[0] *= inv;
+                        hist[1] *= inv;
+                        hist[2] *= inv;
+                        count = count * inv < TEMPORAL_MOVING_LIMIT ? count * inv : TEMPORAL_MOVING_LIMIT;
+                    }
+                    else count = 0.0f;
+                }
+            }
+
+            const float fac = 1.0f / (count + 1.0f);
+            float* next = temporal->next + i * 4;
+            next[0] = hist[0] + (color[i * 3 + 0] - hist[0]) * fac;
+            next[1] = hist[1] + (color[i * 3 + 1] - hist[1]) * fac;
+            next[2] = hist[2] + (color[i * 3 + 2] - hist[2]) * fac;
+            next[3] = count + 1.0f;
+        }
+    }
+
+    /* the resolved frame becomes the history of the next one */
+    const size_t pixels = (size_t)width * height;
+    for (size_t i = 0; i < pixels; ++i) {
+        const float* next = temporal->next + i * 4;
+        memcpy(temporal->color + i * 3, next, sizeof(float) * 3);
+        temporal->count[i] = next[3];
+        temporal->depth[i] = depth[i];
+        memcpy(temporal->normal + i * 3, normal + i * 3, sizeof(float) * 3);
+
+        out[i * 4 + 0] = (unsigned)(CLMPF(sqrtf(next[0])) * 255.0);
+        out[i * 4 + 1] = (unsigned)(CLMPF(sqrtf(next[1])) * 255.0);
+        out[i * 4 + 2] = (unsigned)(CLMPF(sqrtf(next[2])) * 255.0);
+        out[i * 4 + 3] = 255;
+    }
+
+    temporal->cam = *cam;
+    temporal->valid = true;
+    timeline3D_end("resolve", start, -1, -1);
+}
+
+void temporal3D_free(Temporal3D* temporal)
+{
+    free(temporal->color);
+    free(temporal->normal);
+    free(temporal->depth);
+    free(temporal->count);
+    free(temporal->next);
+}
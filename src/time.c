@@ -4,7 +4,7 @@
 
 double time_clock()
 {
-    static struct timespec time;
+    struct timespec time;
     clock_gettime(CLOCK_MONOTONIC, &time);
     return time.tv_sec + time.tv_nsec / 1000000000.0;
 }
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+#include <tracy.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * render timeline
+ *
+ * Spans are recorded into a ring buffer owned by the recording thread, so
+ * recording is two clock reads and a few stores with no locks or shared
+ * writes. Rings are handed out like the stats blocks: a thread takes a free
+ * ring on its first span and gives it back when it exits, so the threads of
+ * consecutive frames share a few rings and every ring reads as one lane of
+ * workers in the trace. A full ring overwrites its oldest spans. Span names
+ * are kept as pointers and must be string literals.
+ */
+
+typedef struct Span3D {
+    const char* name;
+    double start;
+    double end;
+    int32_t x;
+    int32_t y;
+} Span3D;
+
+typedef struct TimelineRing3D {
+    Span3D* spans;
+    uint64_t head; /* spans ever written, the last capacity of them are kept */
+    struct TimelineRing3D* next;
+    uint32_t id;
+    bool used;
+} TimelineRing3D;
+
+bool timeline3D_enabled = false;
+
+static __thread TimelineRing3D* timeline3D_current = NULL;
+static TimelineRing3D* timeline3D_rings = NULL;
+static pthread_mutex_t timeline3D_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t timeline3D_once = PTHREAD_ONCE_INIT;
+static pthread_key_t timeline3D_key;
+static uint64_t timeline3D_mask = 0;
+static double timeline3D_origin = 0.0;
+
+static void timeline3D_release(void* arg)
+{
+    TimelineRing3D* ring = arg;
+    pthread_mutex_lock(&timeline3D_lock);
+    ring->used = false;
+    pthread_mutex_unlock(&timeline3D_lock);
+}
+
+static void timeline3D_init(void)
+{
+    pthread_key_create(&timeline3D_key, &timeline3D_release);
+}
+
+static TimelineRing3D* timeline3D_attach(void)
+{
+    pthread_once(&timeline3D_once, &timeline3D_init);
+
+    pthread_mutex_lock(&timeline3D_lock);
+    uint32_t id = 0;
+    TimelineRing3D** link = &timeline3D_rings;
+    while (*link && (*link)->used) {
+        link = &(*link)->next;
+        ++id;
+    }
+
+    TimelineRing3D* ring = *link;
+    if (!ring) {
+        ring = calloc(1, sizeof(TimelineRing3D));
+        if (ring) {
+            ring->spans = malloc(sizeof(Span3D) * (timeline3D_mask + 1));
+        }
+        if (!ring || !ring->spans) {
+            free(ring);
+            pthread_mutex_unlock(&timeline3D_lock);
+            return NULL;
+        }
+
+        ring->id = id;
+        *link = ring;
+    }
+    ring->used = true;
+    pthread_mutex_unlock(&timeline3D_lock);
+
+    pthread_setspecific(timeline3D_key, ring);
+    timeline3D_current = ring;
+    return ring;
+}
+
+/*
+ * turns recording on with rings of at least capacity spans, before any
+ * thread records. The calling thread takes the first ring, so it is the
+ * one exported as main even when loader threads record before it does.
+ */
+void timeline3D_enable(const uint32_t capacity)
+{
+    uint64_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    timeline3D_mask = size - 1;
+    timeline3D_origin = time_clock();
+    timeline3D_enabled = true;
+    if (!timeline3D_current) {
+        timeline3D_attach();
+    }
+}
+
+void timeline3D_record(const char* name, const double start, const int32_t x, const int32_t y)
+{
+    TimelineRing3D* ring = timeline3D_current ? timeline3D_current : timeline3D_attach();
+    if (!ring) {
+        return;
+    }
+
+    const uint64_t head = ring->head;
+    Span3D* span = ring->spans + (head & timeline3D_mask);
+    span->name = name;
+    span->start = start;
+    span->end = time_clock();
+    span->x = x;
+    span->y = y;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* writes the recorded spans as chrome trace event json, readable by perfetto */
+int timeline3D_export(const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return tracy_error("Could not write file '%s'.\n", path);
+    }
+
+    uint64_t dropped = 0;
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&timeline3D_lock);
+    for (const TimelineRing3D* ring = timeline3D_rings; ring; ring = ring->next) {
+        /* the first ring belongs to the thread that enabled recording */
+        char name[32] = "main";
+        if (ring->id) {
+            sprintf(name, "worker %u", ring->id);
+        }
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", ring->id, name);
+        first = false;
+
+        const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        const uint64_t count = head < timeline3D_mask + 1 ? head : timeline3D_mask + 1;
+        dropped += head - count;
+
+        for (uint64_t i = head - count; i < head; ++i) {
+            const Span3D* span = ring->spans + (i & timeline3D_mask);
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"tracy\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                span->name, ring->id, (span->start - timeline3D_origin) * 1.0e6, (span->end - span->start) * 1.0e6);
+            if (span->x >= 0) {
+                fprintf(file, ",\"args\":{\"x\":%d,\"y\":%d}", span->x, span->y);
+            }
+            fprintf(file, "}");
+        }
+    }
+    pthread_mutex_unlock(&timeline3D_lock);
+
+    fprintf(file, "\n],\"otherData\":{\"dropped\":%llu}}\n", (unsigned long long)dropped);
+    const int status = ferror(file) ? EXIT_FAILURE : EXIT_SUCCESS;
+    fclose(file);
+    return status ? tracy_error("Could not write file '%s'.\n", path) : EXIT_SUCCESS;
+}
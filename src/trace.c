@@ -27,38 +27,110 @@ float vec3_reflect_fresnel(float n1, float n2, vec3 normal, vec3 incident, float
         return lerpf(f0, f90, ret);
 }
 
-static bool ray3D_scatter(const Scene3D* scene, const Material* restrict mat, const Ray3D* restrict ray, Hit3D* restrict rec, vec3* attenuation, Ray3D* restrict scattered, vec3* restrict outLight)
+/*
+ * direct light
+ *
+ * Light reaching a lambert surface from emissive spheres is estimated
+ * twice: by sampling the cone of every sphere with a shadow ray, and by the
+ * cosine distributed bounce when it happens to hit the sphere. Both
+ * estimates are weighted with the power heuristic on their solid angle
+ * pdfs, so small bright lights are found by the shadow rays and large ones
+ * by the bounces without counting either twice. The fresnel reflection
+ * lobe and metal and dielectric surfaces are not weighted, emission they
+ * hit counts in full. Emissive triangles are only found by bounces.
+ */
+
+typedef struct PathVertex3D {
+    vec3 pos;
+    const Material* mat;
+    float pdf; /* of the bounce direction, 0 when it was not from the diffuse lobe */
+} PathVertex3D;
+
+static inline bool ray3D_emitter(const Material* mat)
+{
+    return mat->emissive.x > 0.0F || mat->emissive.y > 0.0F || mat->emissive.z > 0.0F;
+}
+
+static inline float ray3D_power(const float a, const float b)
+{
+    return a * a / (a * a + b * b);
+}
+
+/* solid angle of a sphere seen from pos, 2pi(1 - cos) written to keep tiny lights above 0 */
+static inline float ray3D_light_angle(const Sphere* s, const vec3 pos, float* cosAMax)
+{
+    const float r2 = s->radius * s->radius / vec3_sqmag(_vec3_sub(pos, s->pos));
+    if (r2 >= 1.0F) {
+        return 0.0F;
+    }
+
+    *cosAMax = sqrtf(1.0F - r2);
+    return 2.0F * M_PI * r2 / (1.0F + *cosAMax);
+}
+
+/* weight of emission found by a bounce from the vertex, against sampling the sphere it hit */
+static float ray3D_emission_weight(const Scene3D* scene, const PathVertex3D* from, const size_t object)
+{
+    const size_t first = scene->models.size + scene->triangles.size;
+    if (!from || from->pdf <= 0.0F || object < first) {
+        return 1.0F;
+    }
+
+    const Sphere* s = (const Sphere*)scene->spheres.data + (object - first);
+    const size_t n = ((const size_t*)scene->sphere_materials.data)[object - first];
+    const Material* smat = (const Material*)scene->materials.data + n;
+    float cosAMax;
+    const float omega = smat != from->mat ? ray3D_light_angle(s, from->pos, &cosAMax) : 0.0F;
+    return omega > 0.0F ? ray3D_power(from->pdf, 1.0F / omega) : 1.0F;
+}
+
+/* the normal plus a uniform point on the unit sphere is cosine distributed around the normal */
+static inline vec3 ray3D_cosine(const vec3 normal)
+{
+    const float z = rand3D_signed(), phi = 2.0F * M_PI * rand3D_norm();
+    const float r = sqrtf(_maxf(0.0F, 1.0F - z * z));
+    const vec3 dir = _vec3_add(normal, _vec3_new(r * cosf(phi), r * sinf(phi), z));
+    return _vec3_dot(dir, dir) > 1.0e-12F ? vec3_normal(dir) : normal;
+}
+
+static bool ray3D_scatter(const Scene3D* scene, const Material* restrict mat, const Ray3D* restrict ray, Hit3D* restrict rec, vec3* attenuation, Ray3D* restrict scattered, vec3* restrict outLight, PathVertex3D* restrict vertex)
 {
     const vec3 pos = _ray3D_at(ray, rec->t);
     *outLight = (vec3){0.0F, 0.0F, 0.0F};
+    vertex->pos = pos;
+    vertex->mat = mat;
+    vertex->pdf = 0.0F;
     
     if (mat->type == Lambert) {
         
-        // random point inside unit sphere that is tangent to the hit point
-        vec3 dir = vec3_add(rec->normal, vec3_rand());
-        dir = vec3_normal(dir);
+        const vec3 nl = _vec3_dot(rec->normal, ray->dir) < 0.0 ? rec->normal : _vec3_neg(rec->normal);
+        const vec3 dir = ray3D_cosine(nl);
+        const float fresnel = vec3_reflect_fresnel(1.0F, 1.0F, rec->normal, ray->dir, mat->ri, 1.0F);
 
-        if (frand_norm() < vec3_reflect_fresnel(1.0F, 1.0F, rec->normal, ray->dir, mat->ri, 1.0F)) {
+        if (rand3D_norm() < fresnel) {
             *scattered = ray3D_new(pos, vec3_normal(vec3_lerp(vec3_reflect(ray->dir, rec->normal), dir, mat->roughness * mat->roughness)));
             *attenuation = mat->albedo;
         }
         else {
             *scattered = ray3D_new(pos, dir);
             *attenuation = mat->albedo;
+            vertex->pdf = _maxf(0.0F, _vec3_dot(dir, nl)) / M_PI;
         }
         
-        // sample lights
+        // sample lights, the diffuse lobe takes what the fresnel lobe does not
         const size_t* indices = scene->sphere_materials.data;
         const Material* materials = scene->materials.data;
         const Sphere* s = scene->spheres.data;
         const size_t sphere_count = scene->spheres.size;
+        const size_t first = scene->models.size + scene->triangles.size;
+        const vec3 diffuse = vec3_mult(mat->albedo, (1.0F - fresnel) / M_PI);
         for (size_t i = 0; i < sphere_count; ++i, ++s) {
             
             const size_t n = indices[i];
             const Material* smat = materials + n;
-            
-            if ((smat->emissive.x <= 0.0F && smat->emissive.y <= 0.0F && 
-                smat->emissive.z <= 0.0F) || mat == smat) {
+            float cosAMax;
+            const float omega = ray3D_emitter(smat) && mat != smat ? ray3D_light_angle(s, pos, &cosAMax) : 0.0F;
+            if (omega <= 0.0F) {
                 continue;
             }
             
@@ -68,23 +140,27 @@ static bool ray3D_scatter(const Scene3D* scene, const Material* restrict mat, co
             vec3 su = vec3_normal(vec3_cross(_absf(sw.x) > 0.01F ? _vec3_new(0.0F, 1.0F, 0.0F) : _vec3_new(1.0F, 0.0F, 0.0F), sw));
             vec3 sv = _vec3_cross(sw, su);
             // sample sphere by solid angle
-            float cosAMax = sqrtf(1.0f - s->radius * s->radius / vec3_sqmag(_vec3_sub(pos, s->pos)));
-            float eps1 = frand_norm(), eps2 = frand_norm();
+            float eps1 = rand3D_norm(), eps2 = rand3D_norm();
             float cosA = 1.0f - eps1 + eps1 * cosAMax;
-            float sinA = sqrtf(1.0f - cosA * cosA);
+            float sinA = sqrtf(_maxf(0.0F, 1.0f - cosA * cosA));
             float phi = 2.0 * M_PI * eps2;
             vec3 l = vec3_add(_vec3_mult(su, cosf(phi) * sinA), vec3_add(_vec3_mult(sv, sin(phi) * sinA), _vec3_mult(sw, cosA)));
             l = vec3_normal(l);
+
+            const float cosL = _vec3_dot(l, nl);
+            if (cosL <= 0.0F) {
+                continue;
+            }
             
             // shoot shadow ray
             Hit3D lightHit;
-            size_t hitID;
+            size_t hitID, hitObject;
             Ray3D r = {pos, l};
+            ++stats3D_local()->shadow_rays;
 
-            if (scene3D_hit(scene, &r, &lightHit, &hitID) && hitID == n) {
-                float omega = 2.0 * (1.0 - cosAMax);
-                vec3 nl = _vec3_dot(rec->normal, ray->dir) < 0.0 ? rec->normal : _vec3_neg(rec->normal);
-                *outLight = vec3_add(*outLight, vec3_mult(vec3_prod(mat->albedo, smat->emissive), _maxf(0.0f, _vec3_dot(l, nl)) * omega));
+            if (scene3D_hit_object(scene, &r, &lightHit, &hitID, &hitObject) && hitObject == first + i) {
+                const float weight = ray3D_power(1.0F / omega, cosL / M_PI);
+                *outLight = vec3_add(*outLight, vec3_mult(vec3_prod(diffuse, smat->emissive), cosL * omega * weight));
             }
         }
     }
@@ -93,7 +169,7 @@ static bool ray3D_scatter(const Scene3D* scene, const Material* restrict mat, co
         vec3 refl = vec3_reflect(ray->dir, rec->normal);
         *scattered = ray3D_new(
             pos, 
-            vec3_normal(vec3_add(refl, vec3_mult(vec3_rand(), mat->roughness)))
+            vec3_normal(vec3_add(refl, vec3_mult(rand3D_ball(), mat->roughness)))
         );
         *attenuation = mat->albedo;
         //return _vec3_dot(scattered->dir, rec->normal) > 0.0f;
@@ -120,7 +196,7 @@ static bool ray3D_scatter(const Scene3D* scene, const Material* restrict mat, co
             reflProb = schlick(mat->ri, cosine);
         } else reflProb = 1.0f;
         
-        if (frand_norm() < reflProb) {
+        if (rand3D_norm() < reflProb) {
             *scattered = ray3D_new(pos, vec3_normal(refl));
         }
         else *scattered = ray3D_new(pos, vec3_normal(refr));
@@ -130,21 +206,87 @@ static bool ray3D_scatter(const Scene3D* scene, const Material* restrict mat, co
     return true;
 }
 
-vec3 ray3D_trace(const Scene3D* restrict scene, const Ray3D* restrict ray, const uint32_t depth)
+/* emitted receives the weighted emission of the first hit alone, if given */
+static vec3 ray3D_trace_from(const Scene3D* restrict scene, const Ray3D* restrict ray, const uint32_t depth, const PathVertex3D* from, vec3* emitted)
 {
     Hit3D rec;
-    size_t id;
+    size_t id, object;
+    Stats3D* stats = stats3D_local();
+    if (depth) {
+        ++stats->secondary_rays;
+    }
+    else ++stats->primary_rays;
 
-    if (scene3D_hit(scene, ray, &rec, &id)) {
+    if (scene3D_hit_object(scene, ray, &rec, &id, &object)) {
         Ray3D scattered;
         vec3 attenuation, light;
+        PathVertex3D vertex;
         Material* mat = (Material*)scene->materials.data + id;
-        if (depth < TRACY_MAX_DEPTH && ray3D_scatter(scene, mat, ray, &rec, &attenuation, &scattered, &light)) {
-            return vec3_add(mat->emissive, vec3_add(light, vec3_prod(attenuation, ray3D_trace(scene, &scattered, depth + 1))));
-        } else return mat->emissive;
+        const vec3 emissive = ray3D_emitter(mat) ? vec3_mult(mat->emissive, ray3D_emission_weight(scene, from, object)) : mat->emissive;
+        if (emitted) {
+            *emitted = emissive;
+        }
+        if (depth < TRACY_MAX_DEPTH && ray3D_scatter(scene, mat, ray, &rec, &attenuation, &scattered, &light, &vertex)) {
+            return vec3_add(emissive, vec3_add(light, vec3_prod(attenuation, ray3D_trace_from(scene, &scattered, depth + 1, &vertex, NULL))));
+        }
+        ++stats->paths[depth];
+        return emissive;
     } else {
         // Sky
+        ++stats->paths[depth];
+        if (emitted) {
+            *emitted = (vec3){0.0F, 0.0F, 0.0F};
+        }
         float t = (ray->dir.y + 1.0F) * 0.5F * 0.3F + 0.3F;
         return _vec3_mult(scene->background_color, t);
     }
 }
+
+vec3 ray3D_trace(const Scene3D* restrict scene, const Ray3D* restrict ray, const uint32_t depth)
+{
+    return ray3D_trace_from(scene, ray, depth, NULL, NULL);
+}
+
+/* traces a camera ray like ray3D_trace and records its first hit */
+vec3 ray3D_trace_aov(const Scene3D* restrict scene, const Ray3D* restrict ray, Aov3D* restrict aov)
+{
+    Hit3D rec;
+    size_t id, object;
+    Stats3D* stats = stats3D_local();
+    ++stats->primary_rays;
+
+    if (scene3D_hit_object(scene, ray, &rec, &id, &object)) {
+        Ray3D scattered;
+        vec3 attenuation, light;
+        PathVertex3D vertex;
+        Material* mat = (Material*)scene->materials.data + id;
+        aov->normal = rec.normal;
+        aov->albedo = mat->albedo;
+        aov->depth = rec.t;
+        aov->material = (float)id;
+        aov->object = (float)object;
+        if (ray3D_scatter(scene, mat, ray, &rec, &attenuation, &scattered, &light, &vertex)) {
+            /* emitters the bounce hits are the bsdf half of the direct light */
+            vec3 emitted;
+            const vec3 bounce = ray3D_trace_from(scene, &scattered, 1, &vertex, &emitted);
+            aov->direct = vec3_add(mat->emissive, vec3_add(light, vec3_prod(attenuation, emitted)));
+            aov->indirect = vec3_prod(attenuation, vec3_sub(bounce, emitted));
+        } else {
+            ++stats->paths[0];
+            aov->direct = mat->emissive;
+            aov->indirect = (vec3){0.0F, 0.0F, 0.0F};
+        }
+    } else {
+        ++stats->paths[0];
+        float t = (ray->dir.y + 1.0F) * 0.5F * 0.3F + 0.3F;
+        aov->normal = _vec3_neg(ray->dir);
+        aov->albedo = _vec3_mult(scene->background_color, t);
+        aov->depth = TRACY_MAX_DIST;
+        aov->material = -1.0F;
+        aov->object = -1.0F;
+        aov->direct = aov->albedo;
+        aov->indirect = (vec3){0.0F, 0.0F, 0.0F};
+    }
+
+    return vec3_add(aov->direct, aov->indirect);
+}
@@ -36,6 +36,7 @@ tracy path tracer
 @Eugenio Arteaga
 ****************/
 
+#include <stdio.h>
 #include <stdint.h>
 #include <mass/mass.h>
 #include <photon/photon.h>
@@ -43,11 +44,38 @@ tracy path tracer
 
 /* tracy configurations */
 
-// #define TRACY_PERF /* performance logging (better for cli version) */
 #define TRACY_MAX_DEPTH 8
 #define TRACY_MIN_DIST 0.001f
 #define TRACY_MAX_DIST 1.0e7f
 #define TRACY_OCTREE_LIMIT 8
+#define TRACY_REPORT_DEPTH 32 /* deeper octree levels share the last row */
+#define TRACY_REPORT_BUCKETS 9 /* leaves with 0, 1, 2, 3-4, ... 33-64 and more triangles */
+#define TRACY_REFIT_LIMIT 1.5f /* octree cost growth that triggers a rebuild */
+#define TRACY_LAZY_LEVELS 2 /* octree levels built up front by lazy loads */
+#define TRACY_TILE_SIZE 32
+#define TRACY_BINARY_VERSION 2
+#define TRACY_STREAM_RGB 0
+#define TRACY_STREAM_Y4M 1
+#define TRACY_RENDER_CANCELLED 2
+#define TRACY_STATS_TEXT 1
+#define TRACY_STATS_JSON 2
+#define TRACY_TIMELINE_SPANS (1 << 15) /* per thread ring */
+#define TRACY_AOV_COLOR 0 /* linear radiance */
+#define TRACY_AOV_DEPTH 1
+#define TRACY_AOV_NORMAL 2
+#define TRACY_AOV_ALBEDO 3
+#define TRACY_AOV_MATERIAL 4
+#define TRACY_AOV_OBJECT 5
+#define TRACY_AOV_DIRECT 6 /* emission and light sampled at the first hit */
+#define TRACY_AOV_INDIRECT 7
+#define TRACY_AOV_COUNT 8
+#define TRACY_AOV_BIT(aov) (1u << (aov))
+#define TRACY_HEAT_NODES 1 /* octree nodes visited per sample */
+#define TRACY_HEAT_TESTS 2 /* triangle and sphere tests per sample */
+#define TRACY_HEAT_SHADOW 3 /* shadow rays per sample */
+#define TRACY_HEAT_TIME 4 /* nanoseconds per sample */
+#define TRACY_HEAT_COUNT 5
+#define TRACY_DENOISE_FEATURES (TRACY_AOV_BIT(TRACY_AOV_COLOR) | TRACY_AOV_BIT(TRACY_AOV_DEPTH) | TRACY_AOV_BIT(TRACY_AOV_NORMAL) | TRACY_AOV_BIT(TRACY_AOV_ALBEDO))
 
 /* tracy structs */
 
@@ -84,11 +112,36 @@ typedef struct Oct3D {
     Box3D box;
     struct Oct3D* children;
     struct vector triangles;
+    struct vector indices;
+    uint32_t state;
 } Oct3D;
 
+typedef struct OctNode3D OctNode3D;
+
+typedef struct OctPack3D {
+    Box3D box;
+    OctNode3D* nodes; /* NULL when the octree itself is traversed */
+    Tri3D* triangles;
+    uint32_t node_count;
+    uint32_t triangle_count;
+} OctPack3D;
+
+typedef struct Anim3D {
+    vec3 move;
+    vec3 axis;
+    float angle;
+} Anim3D;
+
 typedef struct Model3D {
     struct vector triangles;
+    struct vector rest;
     Oct3D octree;
+    OctPack3D pack;
+    Anim3D anim;
+    uint32_t frame;
+    uint32_t lazy;
+    bool compact; /* traversed through a packed copy of the octree */
+    float cost;
 } Model3D;
 
 typedef struct Scene3D {
@@ -100,10 +153,27 @@ typedef struct Scene3D {
     struct vector triangle_materials;
     struct vector models;
     vec3 background_color;
+    void* map;
+    size_t map_size;
 } Scene3D;
 
+typedef struct Aov3D {
+    vec3 normal;
+    vec3 albedo;
+    vec3 direct;
+    vec3 indirect;
+    float depth;
+    float material;
+    float object;
+} Aov3D;
+
 typedef struct Render3D {
     uint8_t* buffer;
+    float* aov[TRACY_AOV_COUNT];
+    uint32_t aovs;
+    float* heat; /* per pixel cost, traced instead of radiance when heatmap is set */
+    uint32_t heatmap;
+    Scene3D** replicas; /* per numa node copies of the scene for pinned render3D_render threads */
     uint32_t width;
     uint32_t height;
     uint32_t spp;
@@ -112,25 +182,177 @@ typedef struct Render3D {
     uint32_t timer;
 } Render3D;
 
+typedef struct Tile3D {
+    const uint8_t* pixels; /* first pixel of the tile inside the framebuffer */
+    uint32_t stride;
+    uint32_t x, y;
+    uint32_t width, height;
+    uint32_t done;
+    uint32_t count;
+} Tile3D;
+
+typedef struct Temporal3D {
+    float* color;
+    float* normal;
+    float* depth;
+    float* count;
+    float* next;
+    Cam3D cam;
+    uint32_t width;
+    uint32_t height;
+    bool valid;
+} Temporal3D;
+
+typedef struct Stats3D {
+    uint64_t primary_rays;
+    uint64_t secondary_rays;
+    uint64_t shadow_rays;
+    uint64_t node_visits;
+    uint64_t triangle_tests;
+    uint64_t sphere_tests;
+    uint64_t paths[TRACY_MAX_DEPTH + 1]; /* paths terminated at each bounce */
+    double busy; /* seconds spent rendering */
+} Stats3D;
+
+typedef struct OctReport3D {
+    uint64_t triangles; /* mesh triangles */
+    uint64_t stored; /* triangle copies in octree nodes */
+    uint64_t nodes;
+    uint64_t leaves;
+    uint64_t empty; /* leaves without triangles */
+    uint64_t lazy; /* nodes left to split on first use */
+    uint64_t leaf_triangles;
+    uint64_t interior_triangles; /* straddling their children */
+    uint64_t max_leaf;
+    uint64_t max_interior;
+    uint64_t depth_nodes[TRACY_REPORT_DEPTH];
+    uint64_t depth_triangles[TRACY_REPORT_DEPTH];
+    uint64_t leaf_sizes[TRACY_REPORT_BUCKETS];
+    uint64_t octree_bytes;
+    uint64_t pack_nodes;
+    uint64_t pack_bytes; /* packed octree copies of compact models */
+    uint64_t mesh_bytes;
+    uint64_t loose_triangles; /* scene triangles and spheres outside models */
+    uint64_t spheres;
+    uint32_t max_depth;
+    uint32_t models;
+    double cost; /* summed oct3D_cost of the models */
+} OctReport3D;
+
+typedef struct Output3D Output3D;
+typedef struct Context3D Context3D;
+typedef void (*TileCallback3D)(const Tile3D* tile, void* userdata);
+typedef void (*Update3D)(Scene3D* scene, const uint32_t threads);
+
 /* tracy */
 
 double time_clock();
+void* file_map(const char* filename, size_t* size);
+void file_unmap(void* data, const size_t size);
 
 Render3D render3D_new(const uint32_t width, const uint32_t height, const uint32_t spp);
 bmp_t render3D_bmp(const Render3D* render, const Scene3D* scene);
 void render3D_render(const Render3D* render, const Scene3D* scene);
+void render3D_tile(const Render3D* render, const Scene3D* scene, const Cam3D* cam, uint8_t* buffer, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1);
+void render3D_tile_accum(const Render3D* render, const Scene3D* scene, const Cam3D* cam, float* accum, const uint32_t x0, const uint32_t y0, const uint32_t x1, const uint32_t y1, const uint32_t spp, const uint64_t seed);
+int render3D_batch(const Render3D* render, Scene3D** scenes, const size_t scene_count, const char* const* paths, const uint32_t inflight, Update3D update);
 void render3D_set(Render3D* render);
+void render3D_set_aovs(Render3D* render, const uint32_t aovs);
+uint32_t render3D_aov_channels(const uint32_t aov);
+const char* render3D_aov_name(const uint32_t aov);
+void render3D_resolve(const Render3D* render);
+void render3D_upscale(const Render3D* src, const Render3D* dst);
+void render3D_set_heatmap(Render3D* render, const uint32_t heatmap);
+const char* render3D_heatmap_name(const uint32_t heatmap);
+float render3D_heat_resolve(const Render3D* render, float* mean);
 void render3D_free(Render3D* render);
 
+int image_write(const char* path, const uint8_t* pixels, const uint32_t width, const uint32_t height);
+int image_write_pfm(const char* path, const float* data, const uint32_t width, const uint32_t height, const uint32_t channels);
+Output3D* output3D_create(const uint32_t width, const uint32_t height, const uint32_t buffers, const uint32_t encoders);
+uint8_t* output3D_acquire(Output3D* out);
+Output3D* output3D_stream(FILE* stream, const int format, const uint32_t width, const uint32_t height, const uint32_t fps, const uint32_t buffers);
+void output3D_submit(Output3D* out, uint8_t* pixels, const char* path);
+void output3D_flush(Output3D* out);
+int output3D_free(Output3D* out);
+
+void denoise3D(const Render3D* render, const uint32_t iterations);
+
+Temporal3D temporal3D_create(const uint32_t width, const uint32_t height);
+void temporal3D_reset(Temporal3D* temporal);
+void temporal3D_resolve(Temporal3D* temporal, const Render3D* render, const Cam3D* cam, uint8_t* out);
+void temporal3D_free(Temporal3D* temporal);
+
+Context3D* context3D_create(const uint32_t threads);
+int context3D_submit(Context3D* ctx, const Render3D* render, const Scene3D* scene, TileCallback3D callback, void* userdata);
+void context3D_cancel(Context3D* ctx);
+float context3D_progress(const Context3D* ctx);
+bool context3D_busy(Context3D* ctx);
+int context3D_wait(Context3D* ctx);
+void context3D_free(Context3D* ctx);
+
+Stats3D* stats3D_attach(void);
+uint32_t stats3D_read(Stats3D* threads, const uint32_t max, Stats3D* total);
+void stats3D_reset(void);
+void stats3D_progress(FILE* stream);
+void stats3D_report(FILE* stream, const int format, const uint32_t frames);
+void stats3D_log_frame(const double span);
+void stats3D_log_progress(const uint32_t done, const uint32_t total, const double elapsed);
+
+void timeline3D_enable(const uint32_t capacity);
+void timeline3D_record(const char* name, const double start, const int32_t x, const int32_t y);
+int timeline3D_export(const char* path);
+
+uint32_t cpu3D_count(void);
+uint32_t cpu3D_nodes(void);
+uint32_t cpu3D_node(const uint32_t slot);
+uint32_t cpu3D_node_slot(const uint32_t node);
+void cpu3D_pinning(const bool enable);
+void cpu3D_pin(const uint32_t slot);
+void cpu3D_unpin(void);
+
+uint64_t rand3D_attach(void);
+uint64_t rand3D_hash(const uint64_t a, const uint64_t b);
+void rand3D_seed(const uint64_t seed);
+void rand3D_base(const uint64_t seed);
+
+int dist3D_coordinate(const Render3D* render, Scene3D** scenes, const size_t scene_count, const char* address, const char* const* paths, const uint32_t passes, const uint32_t local, Update3D update);
+int dist3D_work(const Render3D* render, Scene3D** scenes, const size_t scene_count, const char* address, Update3D update);
+
+int server3D_run(const Render3D* render, Scene3D** scenes, const char* const* names, const size_t scene_count, const char* path, const uint32_t jobs, const uint32_t queue);
+
+Model3D* model3D_new(const struct vector triangles);
+Model3D* model3D_create(const struct vector triangles);
+Model3D* model3D_open(const char* filename);
 Model3D* model3D_load(const char* filename);
 void model3D_free(Model3D* model);
 void model3D_move(const Model3D* model, const vec3 trans);
 void model3D_scale(const Model3D* model, const float scale);
 void model3D_scale3D(const Model3D* model, const vec3 scale);
+void model3D_rebuild(Model3D* model);
+void model3D_refit(Model3D* model, const uint32_t threads);
+void model3D_deform(Model3D* model, const Tri3D* triangles, const uint32_t threads);
+void model3D_animate(Model3D* model, const uint32_t threads);
+bool model3D_animated(const Model3D* model);
+void model3D_report(const Model3D* model, OctReport3D* report);
+void model3D_compact(Model3D* model);
 
+Scene3D* scene3D_new(void);
 Scene3D* scene3D_load(const char* filename, const float aspect);
-void scene3D_write(const char* filename, const Scene3D* scene);
+Scene3D* scene3D_load_lazy(const char* filename, const float aspect);
+Scene3D* scene3D_load_binary(const char* filename, const float aspect, const uint32_t lazy);
+int scene3D_write(const char* filename, const Scene3D* scene);
+int scene3D_write_binary(const char* filename, const Scene3D* scene);
+bool scene3D_is_binary(const void* data, const size_t size);
 bool scene3D_hit(const Scene3D* scene, const Ray3D* ray, Hit3D* outHit, size_t* outID);
+bool scene3D_hit_object(const Scene3D* scene, const Ray3D* ray, Hit3D* outHit, size_t* outID, size_t* outObject);
+void scene3D_animate(Scene3D* scene, const uint32_t threads);
+bool scene3D_animated(const Scene3D* scene);
+void scene3D_report(const Scene3D* scene, OctReport3D* report);
+void scene3D_compact(Scene3D* scene);
+Scene3D* scene3D_replicate(const Scene3D* scene);
+Scene3D** scene3D_replicate_nodes(const Scene3D* scene);
+void scene3D_free_replicas(Scene3D** replicas);
 void scene3D_free(Scene3D* free);
 
 Cam3D cam3D_new(const vec3 lookFrom, const vec3 lookAt, const vec3 up, const float fov, const float aspect, const float aperture, const float focusDist);
@@ -138,17 +360,88 @@ Ray3D cam3D_ray(const Cam3D* cam, const float s, const float p);
 void cam3D_update(Cam3D* cam);
 
 vec3 ray3D_trace(const Scene3D* scene, const Ray3D* ray, const uint32_t depth);
+vec3 ray3D_trace_aov(const Scene3D* scene, const Ray3D* ray, Aov3D* aov);
 
 Oct3D oct3D_create(const Box3D box);
 Oct3D oct3D_from_mesh(const Tri3D* triangles, const size_t count);
+Oct3D oct3D_from_mesh_lazy(const Tri3D* triangles, const size_t count, const uint32_t levels);
 bool oct3D_hit(const Oct3D* oct, const Ray3D* ray, Hit3D* hit, float closest);
+void oct3D_refit(Oct3D* oct, const Tri3D* source, const uint32_t threads);
+float oct3D_cost(const Oct3D* oct);
+void oct3D_report(const Oct3D* oct, OctReport3D* report);
 void oct3D_free(Oct3D* oct);
+OctPack3D oct3D_pack(const Oct3D* oct);
+bool oct3D_pack_hit(const OctPack3D* pack, const Ray3D* ray, Hit3D* hit, float closest);
+void oct3D_pack_report(const OctPack3D* pack, OctReport3D* report);
+void oct3D_pack_free(OctPack3D* pack);
 
 int tracy_error(const char* str, ...);
 int tracy_version(void);
 int tracy_help(const int runtime);
 int tracy_log_render3D(const Render3D* render);
 int tracy_log_time(const float time);
+int tracy_log_stats(FILE* file, const int format, const uint32_t frame, const uint32_t frames, const double elapsed, const double span);
+int tracy_log_accel(FILE* file, const char* name, const OctReport3D* report);
+
+/* counters of the calling thread */
+
+extern __thread Stats3D* stats3D_current;
+
+static inline Stats3D* stats3D_local(void)
+{
+    return stats3D_current ? stats3D_current : stats3D_attach();
+}
+
+/* xorshift64* draws of the calling thread, seeded on first use */
+
+extern __thread uint64_t rand3D_state;
+
+static inline uint64_t rand3D_next(void)
+{
+    uint64_t x = rand3D_state ? rand3D_state : rand3D_attach();
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rand3D_state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+/* uniform in [0, 1) */
+static inline float rand3D_norm(void)
+{
+    return (float)(rand3D_next() >> 40) * (1.0F / 16777216.0F);
+}
+
+static inline float rand3D_signed(void)
+{
+    return rand3D_norm() * 2.0F - 1.0F;
+}
+
+/* uniform inside the unit sphere */
+static inline vec3 rand3D_ball(void)
+{
+    vec3 p;
+    do {
+        p = vec3_new(rand3D_signed(), rand3D_signed(), rand3D_signed());
+    } while (p.x * p.x + p.y * p.y + p.z * p.z > 1.0F);
+    return p;
+}
+
+/* timeline spans, begin returns 0 when no trace is recorded and end then does nothing */
+
+extern bool timeline3D_enabled;
+
+static inline double timeline3D_begin(void)
+{
+    return timeline3D_enabled ? time_clock() : 0.0;
+}
+
+static inline void timeline3D_end(const char* name, const double start, const int32_t x, const int32_t y)
+{
+    if (start > 0.0) {
+        timeline3D_record(name, start, x, y);
+    }
+}
 
 #ifdef __cplusplus
 }